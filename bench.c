@@ -0,0 +1,552 @@
+/*CSCE321 HW4: myfs
+	bench.c: in-process benchmark of the __myfs_*_implem functions, without FUSE
+*/
+
+/*Benchmark Details
+	Each workload runs against a fresh anonymous mapping, so results do not depend on the order workloads are run in
+	Only the operations being measured are timed, setup (creating the file to read, the files to stat) is not
+	Every operation's latency is recorded, then sorted for percentiles
+	I/O workloads are run once per I/O size, the rest once
+	Workloads
+		seqwrite		append iosize chunks until the file reaches filesize
+		seqread			read a filesize file front to back in iosize chunks
+		randwrite		write iosize chunks at random aligned offsets within a filesize file
+		randread		read iosize chunks at random aligned offsets within a filesize file
+		create			create ops files, spread over directories of FANOUT entries
+		stat			stat ops files, created as above, in random order
+		unlink			unlink ops files, created as above
+		deep			stat a file at the bottom of a chain of depth directories
+		bigdir			look up random names in a single directory of ops entries, half of them nonexistent
+		truncate		truncate a file to random sizes up to filesize
+	Scaling mode (-t maxthreads)
+		Instead of the workloads, runs a mixed read/stat/write/mkdir load from 1, 2, 4, ... maxthreads threads
+		Every call goes through a mutex held around the implementation, exactly as the FUSE callbacks in myfs.c
+			hold env_lock, and each thread records how long it waited for the lock and how long it held it
+		All thread counts share one image, set up with SHARED_FILES files of filesize bytes, and do ops calls in total
+		The mix is given as read:stat:write:mkdir weights with -m, writes are iosize chunks at random offsets,
+			and mkdirs go into a per-thread directory so they never fail with EEXIST
+*/
+
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "myfs_helper.h"
+
+#define FANOUT		64
+#define MAX_SIZES	16
+#define MAX_THREADS	64
+#define SHARED_FILES	16
+
+/* Declaration for the implementations of the operations */
+
+int __myfs_getattr_implem(void *, size_t, int *, uid_t, gid_t, const char *, struct stat *);
+int __myfs_readdir_implem(void *, size_t, int *, const char *, char ***);
+int __myfs_mknod_implem(void *, size_t, int *, const char *);
+int __myfs_unlink_implem(void *, size_t, int *, const char *);
+int __myfs_mkdir_implem(void *, size_t, int *, const char *);
+int __myfs_rmdir_implem(void *, size_t, int *, const char *);
+int __myfs_rename_implem(void *, size_t, int *, const char *, const char*);
+int __myfs_truncate_implem(void *, size_t, int *, const char *, off_t);
+int __myfs_open_implem(void *, size_t, int *, const char *);
+int __myfs_read_implem(void *, size_t, int *, const char *, char *, size_t, off_t);
+int __myfs_write_implem(void *, size_t, int *, const char *, const char *, size_t, off_t);
+int __myfs_statfs_implem(void *, size_t, int *, struct statvfs*);
+int __myfs_utimens_implem(void *, size_t, int *, const char *, const struct timespec [2]);
+int __myfs_release_implem(void *, size_t, int *, const char *);
+
+/* End of declarations */
+
+typedef struct{
+	void *fsptr;
+	size_t fssize;
+	size_t ops;
+	size_t filesize;
+	size_t iosize;
+	size_t depth;
+	char *buf;
+	uint64_t *lat;
+	size_t done;
+	size_t bytes;
+	size_t failed;
+} benchctx;
+
+typedef struct{
+	pthread_mutex_t env_lock;
+	benchctx *ctx;
+	unsigned mix[4];
+	size_t ops;
+} scaleenv;
+
+typedef struct{
+	scaleenv *env;
+	int id;
+	unsigned seed;
+	size_t done;
+	size_t failed;
+	size_t mkdirs;
+	uint64_t wait;
+	uint64_t hold;
+	uint64_t elapsed;
+	pthread_t thread;
+} scalethread;
+
+typedef struct{
+	const char *name;
+	int isio;
+	void (*run)(benchctx *);
+} workload;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+#define TIMED(ctx,call) do{ \
+		uint64_t __t0=now(); \
+		if((call)<0) (ctx)->failed++; \
+		(ctx)->lat[(ctx)->done++]=now()-__t0; \
+	}while(0)
+#define TIMED_ANY(ctx,call) do{ \
+		uint64_t __t0=now(); \
+		(void)(call); \
+		(ctx)->lat[(ctx)->done++]=now()-__t0; \
+	}while(0)
+
+static int latcmp(const void *A, const void *B)
+{
+	uint64_t a=*(const uint64_t*)A, b=*(const uint64_t*)B;
+	return (a>b)-(a<b);
+}
+
+static void mkfile(benchctx *ctx, const char *path, size_t size)
+{
+	int err;
+	size_t off;
+
+	__myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,path);
+	for(off=0;off<size;off+=ctx->iosize){
+		__myfs_write_implem(ctx->fsptr,ctx->fssize,&err,path,ctx->buf,MIN(ctx->iosize,size-off),off);
+	}__myfs_release_implem(ctx->fsptr,ctx->fssize,&err,path);
+}
+
+static void filepath(char *path, size_t i)
+{
+	sprintf(path,"/d%lu/f%lu",i/FANOUT,i);
+}
+
+static void mkfiles(benchctx *ctx, int timed)
+{
+	char path[64];
+	size_t i;
+	int err;
+
+	for(i=0;i<ctx->ops;i++){
+		if(i%FANOUT==0){
+			sprintf(path,"/d%lu",i/FANOUT);
+			__myfs_mkdir_implem(ctx->fsptr,ctx->fssize,&err,path);
+		}filepath(path,i);
+		if(timed) TIMED(ctx,__myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,path));
+		else __myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,path);
+	}
+}
+
+static void run_seqwrite(benchctx *ctx)
+{
+	size_t off;
+	int err;
+
+	__myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,"/seq");
+	for(off=0;off<ctx->filesize;off+=ctx->iosize){
+		TIMED(ctx,__myfs_write_implem(ctx->fsptr,ctx->fssize,&err,"/seq",ctx->buf,ctx->iosize,off));
+		ctx->bytes+=ctx->iosize;
+	}__myfs_release_implem(ctx->fsptr,ctx->fssize,&err,"/seq");
+}
+
+static void run_seqread(benchctx *ctx)
+{
+	size_t off;
+	int err;
+
+	mkfile(ctx,"/seq",ctx->filesize);
+	for(off=0;off<ctx->filesize;off+=ctx->iosize){
+		TIMED(ctx,__myfs_read_implem(ctx->fsptr,ctx->fssize,&err,"/seq",ctx->buf,ctx->iosize,off));
+		ctx->bytes+=ctx->iosize;
+	}
+}
+
+static void run_randwrite(benchctx *ctx)
+{
+	size_t i, slots=ctx->filesize/ctx->iosize;
+	int err;
+
+	mkfile(ctx,"/rand",ctx->filesize);
+	for(i=0;i<ctx->ops;i++){
+		off_t off=(random()%slots)*ctx->iosize;
+		TIMED(ctx,__myfs_write_implem(ctx->fsptr,ctx->fssize,&err,"/rand",ctx->buf,ctx->iosize,off));
+		ctx->bytes+=ctx->iosize;
+	}
+}
+
+static void run_randread(benchctx *ctx)
+{
+	size_t i, slots=ctx->filesize/ctx->iosize;
+	int err;
+
+	mkfile(ctx,"/rand",ctx->filesize);
+	for(i=0;i<ctx->ops;i++){
+		off_t off=(random()%slots)*ctx->iosize;
+		TIMED(ctx,__myfs_read_implem(ctx->fsptr,ctx->fssize,&err,"/rand",ctx->buf,ctx->iosize,off));
+		ctx->bytes+=ctx->iosize;
+	}
+}
+
+static void run_create(benchctx *ctx)
+{
+	mkfiles(ctx,1);
+}
+
+static void run_stat(benchctx *ctx)
+{
+	char path[64];
+	struct stat st;
+	size_t i;
+	int err;
+
+	mkfiles(ctx,0);
+	for(i=0;i<ctx->ops;i++){
+		filepath(path,random()%ctx->ops);
+		TIMED(ctx,__myfs_getattr_implem(ctx->fsptr,ctx->fssize,&err,0,0,path,&st));
+	}
+}
+
+static void run_unlink(benchctx *ctx)
+{
+	char path[64];
+	size_t i;
+	int err;
+
+	mkfiles(ctx,0);
+	for(i=0;i<ctx->ops;i++){
+		filepath(path,i);
+		TIMED(ctx,__myfs_unlink_implem(ctx->fsptr,ctx->fssize,&err,path));
+	}
+}
+
+static void run_deep(benchctx *ctx)
+{
+	char *path=malloc(ctx->depth*4+8);
+	struct stat st;
+	size_t i, len=0;
+	int err;
+
+	for(i=0;i<ctx->depth;i++){
+		len+=sprintf(&path[len],"/d%lu",i%10);
+		__myfs_mkdir_implem(ctx->fsptr,ctx->fssize,&err,path);
+	}strcpy(&path[len],"/f");
+	__myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,path);
+	for(i=0;i<ctx->ops;i++){
+		TIMED(ctx,__myfs_getattr_implem(ctx->fsptr,ctx->fssize,&err,0,0,path,&st));
+	}free(path);
+}
+
+static void run_bigdir(benchctx *ctx)
+{
+	char path[64];
+	struct stat st;
+	size_t i;
+	int err;
+
+	__myfs_mkdir_implem(ctx->fsptr,ctx->fssize,&err,"/big");
+	for(i=0;i<ctx->ops;i++){
+		sprintf(path,"/big/entry%lu",i);
+		__myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,path);
+	}for(i=0;i<ctx->ops;i++){
+		sprintf(path,"/big/entry%lu",random()%(2*ctx->ops));
+		TIMED_ANY(ctx,__myfs_getattr_implem(ctx->fsptr,ctx->fssize,&err,0,0,path,&st));
+	}
+}
+
+static void run_truncate(benchctx *ctx)
+{
+	size_t i;
+	int err;
+
+	__myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,"/trunc");
+	for(i=0;i<ctx->ops;i++){
+		TIMED(ctx,__myfs_truncate_implem(ctx->fsptr,ctx->fssize,&err,"/trunc",random()%(ctx->filesize+1)));
+	}
+}
+
+static const workload workloads[]={
+	{"seqwrite",1,run_seqwrite},
+	{"seqread",1,run_seqread},
+	{"randwrite",1,run_randwrite},
+	{"randread",1,run_randread},
+	{"create",0,run_create},
+	{"stat",0,run_stat},
+	{"unlink",0,run_unlink},
+	{"deep",0,run_deep},
+	{"bigdir",0,run_bigdir},
+	{"truncate",0,run_truncate},
+	{NULL,0,NULL}
+};
+
+static double pct(benchctx *ctx, double p)
+{
+	size_t i=(size_t)(p*(ctx->done-1)+0.5);
+	return ctx->lat[i]/1e3;
+}
+
+static int runone(benchctx *ctx, const workload *wl)
+{
+	uint64_t t0, t1;
+	double secs;
+	size_t maxops=ctx->ops;
+
+	if(wl->isio && (wl->run==run_seqwrite || wl->run==run_seqread)) maxops=CLDIV(ctx->filesize,ctx->iosize);
+	if((ctx->lat=malloc(maxops*sizeof(uint64_t)))==NULL) return -1;
+	ctx->fsptr=mmap(NULL,ctx->fssize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if(ctx->fsptr==MAP_FAILED){
+		free(ctx->lat);
+		return -1;
+	}ctx->done=0;
+	ctx->bytes=0;
+	ctx->failed=0;
+
+	t0=now();
+	wl->run(ctx);
+	t1=now();
+	secs=(t1-t0)/1e9;
+
+	if(ctx->done>0){
+		qsort(ctx->lat,ctx->done,sizeof(uint64_t),latcmp);
+		printf("%-10s %8lu %8lu %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %10.1f",wl->name,
+			(wl->isio)?ctx->iosize:0,ctx->done,ctx->done/secs,
+			pct(ctx,0.5),pct(ctx,0.9),pct(ctx,0.99),pct(ctx,0.999),ctx->lat[ctx->done-1]/1e3,
+			(ctx->bytes)?ctx->bytes/secs/(1<<20):0.0);
+		if(ctx->failed) printf("  (%lu failed)",ctx->failed);
+		putchar('\n');
+	}munmap(ctx->fsptr,ctx->fssize);
+	free(ctx->lat);
+	return 0;
+}
+
+#define LOCKED(th,call) ({ \
+		uint64_t __t0=now(), __t1, __t2; \
+		int __res; \
+		pthread_mutex_lock(&(th)->env->env_lock); \
+		__t1=now(); \
+		__res=(call); \
+		__t2=now(); \
+		pthread_mutex_unlock(&(th)->env->env_lock); \
+		(th)->wait+=__t1-__t0; \
+		(th)->hold+=__t2-__t1; \
+		__res; \
+	})
+
+static void *scaleworker(void *arg)
+{
+	scalethread *th=arg;
+	benchctx *ctx=th->env->ctx;
+	unsigned *mix=th->env->mix;
+	unsigned total=mix[0]+mix[1]+mix[2]+mix[3];
+	char *buf=malloc(ctx->iosize);
+	char path[64];
+	struct stat st;
+	uint64_t t0=now();
+	size_t slots=ctx->filesize/ctx->iosize;
+	int err, res;
+
+	if(buf==NULL) return NULL;
+	memset(buf,th->id,ctx->iosize);
+	sprintf(path,"/t%d",th->id);
+	LOCKED(th,__myfs_mkdir_implem(ctx->fsptr,ctx->fssize,&err,path));
+	while(th->done<th->env->ops){
+		unsigned pick=rand_r(&th->seed)%total;
+		off_t off=(rand_r(&th->seed)%slots)*ctx->iosize;
+		sprintf(path,"/s/f%d",rand_r(&th->seed)%SHARED_FILES);
+		if(pick<mix[0]){
+			res=LOCKED(th,__myfs_read_implem(ctx->fsptr,ctx->fssize,&err,path,buf,ctx->iosize,off));
+		}else if((pick-=mix[0])<mix[1]){
+			res=LOCKED(th,__myfs_getattr_implem(ctx->fsptr,ctx->fssize,&err,0,0,path,&st));
+		}else if((pick-=mix[1])<mix[2]){
+			res=LOCKED(th,__myfs_write_implem(ctx->fsptr,ctx->fssize,&err,path,buf,ctx->iosize,off));
+		}else{
+			sprintf(path,"/t%d/d%lu",th->id,th->mkdirs++);
+			res=LOCKED(th,__myfs_mkdir_implem(ctx->fsptr,ctx->fssize,&err,path));
+		}if(res<0) th->failed++;
+		th->done++;
+	}th->elapsed=now()-t0;
+	free(buf);
+	return NULL;
+}
+
+static int runscale(benchctx *ctx, unsigned *mix, int maxthreads, int verbose)
+{
+	scaleenv env;
+	scalethread *ths;
+	double base=0;
+	char path[64];
+	int nthreads, i, err;
+
+	env.ctx=ctx;
+	memcpy(env.mix,mix,sizeof(env.mix));
+	if(pthread_mutex_init(&env.env_lock,NULL)!=0) return -1;
+	if((ths=calloc(maxthreads,sizeof(scalethread)))==NULL) return -1;
+	ctx->fsptr=mmap(NULL,ctx->fssize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if(ctx->fsptr==MAP_FAILED){
+		free(ths);
+		return -1;
+	}__myfs_mkdir_implem(ctx->fsptr,ctx->fssize,&err,"/s");
+	for(i=0;i<SHARED_FILES;i++){
+		sprintf(path,"/s/f%d",i);
+		mkfile(ctx,path,ctx->filesize);
+	}
+
+	printf("mix read:stat:write:mkdir %u:%u:%u:%u, %lu ops per run, iosize %lu\n",
+		mix[0],mix[1],mix[2],mix[3],ctx->ops,ctx->iosize);
+	printf("%7s %10s %8s %10s %10s %10s %10s %10s %8s\n","threads","ops/s","speedup","min thr/s","max thr/s",
+		"wait(us)","hold(us)","lock util","failed");
+	for(nthreads=1;nthreads<=maxthreads;nthreads=(nthreads==maxthreads)?nthreads+1:MIN(nthreads*2,maxthreads)){
+		uint64_t t0, wall, wait=0, hold=0;
+		double minthr=0, maxthr=0, ops;
+		size_t done=0, failed=0;
+
+		env.ops=ctx->ops/nthreads;
+		t0=now();
+		for(i=0;i<nthreads;i++){
+			size_t mkdirs=ths[i].mkdirs;
+			memset(&ths[i],0,sizeof(scalethread));
+			ths[i].mkdirs=mkdirs;	/* thread i mkdirs into the same /t<i> every round, keep its names unique */
+			ths[i].env=&env;
+			ths[i].id=i;
+			ths[i].seed=random()+i;
+			if(pthread_create(&ths[i].thread,NULL,scaleworker,&ths[i])!=0){
+				perror("Cannot create thread");
+				nthreads=i;
+				break;
+			}
+		}for(i=0;i<nthreads;i++) pthread_join(ths[i].thread,NULL);
+		wall=now()-t0;
+		if(nthreads==0) break;
+
+		for(i=0;i<nthreads;i++){
+			double thr=(ths[i].elapsed)?ths[i].done/(ths[i].elapsed/1e9):0;
+			if(i==0 || thr<minthr) minthr=thr;
+			if(thr>maxthr) maxthr=thr;
+			done+=ths[i].done;
+			failed+=ths[i].failed;
+			wait+=ths[i].wait;
+			hold+=ths[i].hold;
+		}ops=done/(wall/1e9);
+		if(nthreads==1) base=ops;
+		printf("%7d %10.0f %7.2fx %10.0f %10.0f %10.2f %10.2f %9.1f%% %8lu\n",nthreads,ops,(base>0)?ops/base:0,
+			minthr,maxthr,(double)wait/done/1e3,(double)hold/done/1e3,100.0*hold/wall,failed);
+		if(verbose){
+			for(i=0;i<nthreads;i++){
+				printf("\tthread %2d: %8lu ops %10.0f ops/s, wait %8.3fs hold %8.3fs\n",i,ths[i].done,
+					(ths[i].elapsed)?ths[i].done/(ths[i].elapsed/1e9):0,ths[i].wait/1e9,ths[i].hold/1e9);
+			}
+		}
+	}munmap(ctx->fsptr,ctx->fssize);
+	pthread_mutex_destroy(&env.env_lock);
+	free(ths);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	const workload *wl;
+
+	fprintf(stderr,"usage: %s [-s imagesize] [-n ops] [-f filesize] [-b iosize[,iosize...]] [-d depth]"
+		" [-r seed] [-w workload[,workload...]]\n"
+		"       %s -t maxthreads [-m read:stat:write:mkdir] [-v] [-s imagesize] [-n ops] [-f filesize] [-b iosize]\n"
+		"workloads:",name,name);
+	for(wl=workloads;wl->name!=NULL;wl++) fprintf(stderr," %s",wl->name);
+	fprintf(stderr,"\n");
+}
+
+int main(int argc, char *argv[])
+{
+	benchctx ctx;
+	const workload *wl;
+	const char *which="all";
+	size_t sizes[MAX_SIZES]={4096,65536,1048576};
+	size_t nsizes=3, maxio=0, i;
+	unsigned mix[4]={50,30,15,5};
+	int opt, maxthreads=0, verbose=0;
+
+	memset(&ctx,0,sizeof(ctx));
+	ctx.fssize=(size_t)512<<20;
+	ctx.ops=10000;
+	ctx.filesize=(size_t)16<<20;
+	ctx.depth=32;
+	while((opt=getopt(argc,argv,"s:n:f:b:d:r:w:t:m:vh"))!=-1){
+		char *tok;
+		switch(opt){
+			case 's': ctx.fssize=strtoull(optarg,NULL,0); break;
+			case 'n': ctx.ops=strtoull(optarg,NULL,0); break;
+			case 'f': ctx.filesize=strtoull(optarg,NULL,0); break;
+			case 'd': ctx.depth=strtoull(optarg,NULL,0); break;
+			case 'r': srandom(atoi(optarg)); break;
+			case 'w': which=optarg; break;
+			case 't': maxthreads=atoi(optarg); break;
+			case 'v': verbose=1; break;
+			case 'm':
+				if(sscanf(optarg,"%u:%u:%u:%u",&mix[0],&mix[1],&mix[2],&mix[3])!=4 || mix[0]+mix[1]+mix[2]+mix[3]==0){
+					usage(argv[0]);
+					return 1;
+				}break;
+			case 'b':
+				for(nsizes=0,tok=strtok(optarg,",");tok!=NULL && nsizes<MAX_SIZES;tok=strtok(NULL,",")){
+					sizes[nsizes++]=strtoull(tok,NULL,0);
+				}break;
+			default: usage(argv[0]); return 1;
+		}
+	}for(i=0;i<nsizes;i++){
+		if(sizes[i]==0 || sizes[i]>ctx.filesize){
+			fprintf(stderr,"I/O sizes must be between 1 and the file size\n");
+			return 1;
+		}if(sizes[i]>maxio) maxio=sizes[i];
+	}if(ctx.ops==0 || ctx.fssize<ctx.filesize*2){
+		fprintf(stderr,"Need at least one op and an image twice the file size\n");
+		return 1;
+	}if((ctx.buf=malloc(maxio))==NULL) return 1;
+	memset(ctx.buf,0xa5,maxio);
+
+	if(maxthreads>0){
+		ctx.iosize=sizes[0];
+		if(maxthreads>MAX_THREADS) maxthreads=MAX_THREADS;
+		if(ctx.fssize<ctx.filesize*(SHARED_FILES+1)){
+			fprintf(stderr,"Scaling mode needs an image larger than %d files\n",SHARED_FILES+1);
+			return 1;
+		}if(runscale(&ctx,mix,maxthreads,verbose)!=0) perror("scaling");
+		free(ctx.buf);
+		return 0;
+	}
+
+	printf("image %lu MB, %lu ops, file %lu KB\n",ctx.fssize>>20,ctx.ops,ctx.filesize>>10);
+	printf("%-10s %8s %8s %10s %9s %9s %9s %9s %9s %10s\n","workload","iosize","ops","ops/s",
+		"p50(us)","p90(us)","p99(us)","p99.9(us)","max(us)","MB/s");
+	for(wl=workloads;wl->name!=NULL;wl++){
+		const char *w=which;
+		size_t len=strlen(wl->name);
+		int selected=!strcmp(which,"all");
+		while(!selected && (w=strstr(w,wl->name))!=NULL){
+			selected=(w==which || w[-1]==',') && (w[len]==',' || w[len]=='\0');
+			w+=len;
+		}if(!selected) continue;
+		if(wl->isio){
+			for(i=0;i<nsizes;i++){
+				ctx.iosize=sizes[i];
+				if(runone(&ctx,wl)!=0) perror(wl->name);
+			}
+		}else{
+			ctx.iosize=maxio;
+			if(runone(&ctx,wl)!=0) perror(wl->name);
+		}
+	}free(ctx.buf);
+	return 0;
+}
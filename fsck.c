@@ -0,0 +1,440 @@
+/*CSCE321 HW4: myfs
+	fsck.c: offline consistency checker and fragmentation analyzer for filesystem images
+*/
+
+/*Checker Details
+	The image is mapped read-only and never modified
+	fsck checks images of the format it is built for, with or without MYFS_COMPACT, and names the other format's images
+	Files may hold more blocks than their size needs, the excess is reserved for appends and summed against the header
+		unless preallocated by fallocate, holes punched in files are map slots without a block
+	Directory entries must carry the length and hash of their name, as dirmod compares those first
+	Unlinked nodes still holding blocks must be on the orphan list, which is walked serially once the workers finish
+	Nodes are checked in parallel: the node table is split into chunks which worker threads claim from a shared counter
+		each worker walks the block maps of its nodes and marks their blocks in a shared bitmap with atomic or,
+		so a block claimed twice is caught by whichever thread claims it second
+		directory entries are counted into a shared reference table, compared against nlinks once all workers finish
+	The free list can only be walked serially, so one worker takes it as its first task before claiming node chunks
+	Afterwards the used and free bitmaps are compared word-wise to find leaked blocks and allocated blocks on the free list,
+		and each directory's parent chain is followed to the root to find disconnected subtrees
+	Histograms are power-of-two buckets: free region sizes in blocks, and extents (contiguous runs) per file
+*/
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdarg.h>
+
+#include "myfs_helper.h"
+
+#define CHUNK_NODES	4096
+#define HIST_BUCKETS	48
+#define MAX_REPORTS	32
+
+typedef struct{
+	void *fsptr;
+	size_t nodect;
+	uint64_t *used;
+	uint64_t *freed;
+	size_t *refs;
+	nodei *parent;
+	size_t next;
+	size_t errors;
+	size_t reports;
+	int verbose;
+
+	size_t files, dirs, orphans, pending, pendblks;
+	size_t fileblks, dirblks, offblks;
+	size_t fragged, extents;
+	size_t reserved;
+	size_t freeregs, freeblks;
+	size_t freehist[HIST_BUCKETS];
+	size_t fraghist[HIST_BUCKETS];
+	pthread_mutex_t report_lock;
+} fsckstate;
+
+static void report(fsckstate *st, const char *fmt, ...) __attribute__((format(printf,2,3)));
+static void report(fsckstate *st, const char *fmt, ...)
+{
+	va_list ap;
+
+	pthread_mutex_lock(&st->report_lock);
+	st->errors++;
+	if(st->verbose || st->reports++<MAX_REPORTS){
+		va_start(ap,fmt);
+		vprintf(fmt,ap);
+		va_end(ap);
+		putchar('\n');
+	}pthread_mutex_unlock(&st->report_lock);
+}
+
+static size_t bucket(size_t n)
+{
+	size_t b=0;
+	while(n>1 && b<HIST_BUCKETS-1){ n>>=1; b++; }
+	return b;
+}
+
+static void hist_add(size_t *hist, size_t n)
+{
+	__atomic_fetch_add(&hist[bucket(n)],1,__ATOMIC_RELAXED);
+}
+
+static void hist_print(const char *title, const char *unit, size_t *hist)
+{
+	size_t i, max=0, total=0;
+
+	for(i=0;i<HIST_BUCKETS;i++){
+		total+=hist[i];
+		if(hist[i]>max) max=hist[i];
+	}printf("%s (%lu total)\n",title,total);
+	if(total==0) return;
+	for(i=0;i<HIST_BUCKETS;i++){
+		int bar;
+		if(hist[i]==0) continue;
+		bar=(int)((hist[i]*40+max-1)/max);
+		printf("\t%10lu-%-10lu %s %10lu %5.1f%% %.*s\n",(size_t)1<<i,((size_t)2<<i)-1,unit,
+			hist[i],100.0*hist[i]/total,bar,"########################################");
+	}
+}
+
+/*marks a block as used, returns 0 if it was already claimed or out of range*/
+static int markblk(fsckstate *st, nodei node, blkset blk, const char *what)
+{
+	void *fsptr=st->fsptr;
+	fsheader *fshead=fsptr;
+	uint64_t bit;
+
+	if(blk<fshead->ntsize || blk>=fshead->size){
+		report(st,"node %ld: %s block %lu outside data region [%lu,%lu)",(long)node,what,(size_t)blk,(size_t)fshead->ntsize,(size_t)fshead->size);
+		return 0;
+	}bit=(uint64_t)1<<(blk%64);
+	if(__atomic_fetch_or(&st->used[blk/64],bit,__ATOMIC_RELAXED)&bit){
+		report(st,"node %ld: %s block %lu is allocated more than once",(long)node,what,(size_t)blk);
+		return 0;
+	}return 1;
+}
+
+static void checkdir(fsckstate *st, nodei dir, blkset dblk, size_t *entries, int *ended)
+{
+	void *fsptr=st->fsptr;
+	direntry *df=B2P(dblk);
+	blkdex entry;
+
+	for(entry=0;entry<FILES_DIR;entry++){
+		nodei child=df[entry].node;
+		if(*ended) return;
+		if(child==NONODE){
+			*ended=1;
+			return;
+		}(*entries)++;
+		if(child<=0 || (size_t)child>=st->nodect){
+			report(st,"dir %ld: entry %lu has bad node %ld",(long)dir,*entries-1,(long)child);
+			continue;
+		}if(memchr(df[entry].name,'\0',NAMELEN)==NULL || df[entry].name[0]=='\0'){
+			report(st,"dir %ld: entry %lu (node %ld) has a bad name",(long)dir,*entries-1,(long)child);
+		}else if(df[entry].len!=strlen(df[entry].name) || df[entry].hash!=namehash(df[entry].name,df[entry].len)){
+			report(st,"dir %ld: entry %lu (node %ld) has a stale name length or hash",(long)dir,*entries-1,(long)child);
+		}__atomic_fetch_add(&st->refs[child],1,__ATOMIC_RELAXED);
+		__atomic_store_n(&st->parent[child],dir,__ATOMIC_RELAXED);
+	}
+}
+
+static void checknode(fsckstate *st, nodei node)
+{
+	void *fsptr=st->fsptr;
+	fsheader *fshead=fsptr;
+	inode *nd=(inode*)O2P(fshead->nodetbl)+node;
+	nodemap *nm=NODEMAP(fshead)+node;
+	size_t counted=0, expect, entries=0, extents=0, offct=0;
+	blkset last=NULLOFF, oblk;
+	blkdex i;
+	int isdir, ended=0, orphan=(nd->flags&NODE_ORPHAN)!=0;
+
+	if(nd->nlinks==0 && nm->blocks[0]==NULLOFF && !orphan) return;
+	isdir=(nd->mode==DIRMODE);
+	if(orphan){
+		__atomic_fetch_add(&st->pending,1,__ATOMIC_RELAXED);
+		if(nd->nlinks!=0 || isdir) report(st,"node %ld: on the orphan list but linked or a directory",(long)node);
+	}else if(nd->nlinks==0){
+		__atomic_fetch_add(&st->orphans,1,__ATOMIC_RELAXED);
+		report(st,"node %ld: unlinked but still holds blocks",(long)node);
+	}else if(!isdir && nd->mode!=FILEMODE){
+		report(st,"node %ld: linked with bad mode %o",(long)node,nd->mode);
+		return;
+	}
+
+	for(i=0;i<OFFS_NODE && counted<=nm->nblocks;i++){
+		if(nm->blocks[i]==NULLOFF) break;
+		if(nm->blocks[i]==HOLE){
+			if(isdir) report(st,"dir %ld: hole in block map",(long)node);
+			counted++;
+			continue;
+		}if(markblk(st,node,nm->blocks[i],"data")){
+			if(isdir) checkdir(st,node,nm->blocks[i],&entries,&ended);
+		}if(counted==0 || nm->blocks[i]!=last+1) extents++;
+		last=nm->blocks[i];
+		counted++;
+	}for(oblk=nm->blocklist;oblk!=NULLOFF && counted<=nm->nblocks;){
+		offblock *offs;
+		if(!markblk(st,node,oblk,"offset")) break;
+		offct++;
+		offs=(offblock*)B2P(oblk);
+		for(i=0;i<OFFS_BLOCK && counted<=nm->nblocks;i++){
+			if(offs->blocks[i]==NULLOFF) break;
+			if(offs->blocks[i]==HOLE){
+				if(isdir) report(st,"dir %ld: hole in block map",(long)node);
+				counted++;
+				continue;
+			}if(markblk(st,node,offs->blocks[i],"data")){
+				if(isdir) checkdir(st,node,offs->blocks[i],&entries,&ended);
+			}if(counted==0 || offs->blocks[i]!=last+1) extents++;
+			last=offs->blocks[i];
+			counted++;
+		}oblk=offs->next;
+	}
+
+	if(counted!=nm->nblocks){
+		report(st,"node %ld: block map holds %s%lu blocks, nblocks is %lu",(long)node,
+			(counted>nm->nblocks)?"over ":"",counted,(size_t)nm->nblocks);
+	}if(orphan){
+		expect=nm->nblocks;
+		__atomic_fetch_add(&st->pendblks,counted,__ATOMIC_RELAXED);
+	}else if(isdir){
+		expect=CLDIV(nd->size,FILES_DIR);
+		if(entries!=nd->size) report(st,"dir %ld: %lu entries found, size is %lu",(long)node,entries,nd->size);
+		__atomic_fetch_add(&st->dirs,1,__ATOMIC_RELAXED);
+		__atomic_fetch_add(&st->dirblks,counted,__ATOMIC_RELAXED);
+	}else{
+		expect=CLDIV(nd->size,BLKSZ);
+		if(nm->vsize>nd->size) report(st,"file %ld: valid size %lu is past size %lu",(long)node,nm->vsize,nd->size);
+		if(nm->nblocks>expect){
+			if(!(nd->flags&NODE_KEEP)) __atomic_fetch_add(&st->reserved,nm->nblocks-expect,__ATOMIC_RELAXED);
+			expect=nm->nblocks;
+		}__atomic_fetch_add(&st->files,1,__ATOMIC_RELAXED);
+		__atomic_fetch_add(&st->fileblks,counted,__ATOMIC_RELAXED);
+		if(extents>0) hist_add(st->fraghist,extents);
+		if(extents>1) __atomic_fetch_add(&st->fragged,1,__ATOMIC_RELAXED);
+		__atomic_fetch_add(&st->extents,extents,__ATOMIC_RELAXED);
+	}if(expect!=nm->nblocks){
+		report(st,"node %ld: size %lu needs %lu blocks, nblocks is %lu",(long)node,nd->size,expect,(size_t)nm->nblocks);
+	}__atomic_fetch_add(&st->offblks,offct,__ATOMIC_RELAXED);
+}
+
+static void checkfree(fsckstate *st)
+{
+	void *fsptr=st->fsptr;
+	fsheader *fshead=fsptr;
+	blkset freeoff=fshead->freelist, prevend=0;
+	size_t total=0, regions=0;
+
+	while(freeoff!=NULLOFF){
+		freereg *fhead=(freereg*)B2P(freeoff);
+		sz_blk j;
+		if(freeoff<fshead->ntsize || freeoff>=fshead->size || fhead->size==0 || fhead->size>fshead->size-freeoff){
+			report(st,"free list: bad region %lu of %lu blocks",(size_t)freeoff,(size_t)((freeoff<fshead->size)?fhead->size:0));
+			break;
+		}if(freeoff<prevend){
+			report(st,"free list: region %lu is out of order or overlaps",(size_t)freeoff);
+			break;
+		}if(regions>0 && freeoff==prevend){
+			report(st,"free list: region %lu not merged with its predecessor",(size_t)freeoff);
+		}for(j=0;j<fhead->size;j++){
+			blkset blk=freeoff+j;
+			st->freed[blk/64]|=(uint64_t)1<<(blk%64);
+		}hist_add(st->freehist,fhead->size);
+		total+=fhead->size;
+		regions++;
+		prevend=freeoff+fhead->size;
+		freeoff=fhead->next;
+	}if(total!=fshead->free){
+		report(st,"free list: %lu blocks on list, header says %lu",total,(size_t)fshead->free);
+	}st->freeregs=regions;
+	st->freeblks=total;
+}
+
+static void *worker(void *arg)
+{
+	fsckstate *st=arg;
+
+	size_t task, i, end;
+
+	while((task=__atomic_fetch_add(&st->next,1,__ATOMIC_RELAXED))<=CLDIV(st->nodect,CHUNK_NODES)){
+		if(task==0){
+			checkfree(st);
+			continue;
+		}end=MIN(task*CHUNK_NODES,st->nodect);
+		for(i=(task-1)*CHUNK_NODES;i<end;i++) checknode(st,i);
+	}return NULL;
+}
+
+static void checkblocks(fsckstate *st)
+{
+	void *fsptr=st->fsptr;
+	fsheader *fshead=fsptr;
+	size_t w, words=CLDIV(fshead->size,64);
+	size_t leaked=0, both=0;
+
+	for(w=0;w<words;w++){
+		uint64_t valid=~(uint64_t)0, lost, dup;
+		if(w*64<fshead->ntsize) valid&=(fshead->ntsize-w*64>=64)?0:~(uint64_t)0<<(fshead->ntsize-w*64);
+		if(fshead->size-w*64<64) valid&=((uint64_t)1<<(fshead->size-w*64))-1;
+		lost=~(st->used[w]|st->freed[w])&valid;
+		dup=st->used[w]&st->freed[w];
+		if(lost){
+			leaked+=__builtin_popcountll(lost);
+			if(st->verbose) report(st,"blocks: leaked block(s) in %lu-%lu (mask %016llx)",w*64,w*64+63,(unsigned long long)lost);
+		}if(dup){
+			both+=__builtin_popcountll(dup);
+			report(st,"blocks: allocated block(s) on free list in %lu-%lu (mask %016llx)",w*64,w*64+63,(unsigned long long)dup);
+		}
+	}if(leaked){
+		if(!st->verbose) report(st,"blocks: %lu blocks neither allocated nor free",leaked);
+		else printf("%lu leaked blocks\n",leaked);
+	}if(both) printf("%lu blocks both allocated and free\n",both);
+}
+
+static void checklinks(fsckstate *st)
+{
+	void *fsptr=st->fsptr;
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	size_t i;
+
+	if(nodetbl[0].mode!=DIRMODE || nodetbl[0].nlinks!=1) report(st,"root: bad mode or link count");
+	if(st->refs[0]!=0) report(st,"root: linked from %lu directory entries",st->refs[0]);
+	for(i=1;i<st->nodect;i++){
+		if(st->refs[i]!=nodetbl[i].nlinks){
+			report(st,"node %lu: %lu directory entries, nlinks is %lu",i,st->refs[i],(size_t)nodetbl[i].nlinks);
+		}if(st->refs[i]>0 && nodetbl[i].mode==DIRMODE){
+			nodei up=st->parent[i];
+			size_t depth=0;
+			while(up!=0 && st->refs[up]>0 && depth++<st->nodect) up=st->parent[up];
+			if(up!=0) report(st,"dir %lu: not connected to the root",i);
+		}
+	}
+}
+
+static void checkorphans(fsckstate *st)
+{
+	void *fsptr=st->fsptr;
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	size_t listed=0;
+	nodei node;
+
+	for(node=fshead->orphans;node!=0;node=maptbl[node].next){
+		if(node<1 || (size_t)node>=st->nodect){
+			report(st,"orphan list: bad node %ld",(long)node);
+			return;
+		}if(!(nodetbl[node].flags&NODE_ORPHAN)){
+			report(st,"orphan list: node %ld is not marked as an orphan",(long)node);
+			return;
+		}if(++listed>st->pending){
+			report(st,"orphan list: longer than the %lu marked orphans, or a cycle",st->pending);
+			return;
+		}
+	}if(listed!=st->pending) report(st,"orphan list: %lu nodes, %lu marked as orphans",listed,st->pending);
+}
+
+int main(int argc, char *argv[])
+{
+	fsckstate st;
+	fsheader *fshead;
+	pthread_t *threads;
+	struct stat sb;
+	struct timespec t0, t1;
+	void *fsptr;
+	long nthreads=sysconf(_SC_NPROCESSORS_ONLN);
+	int fd, opt, i;
+
+	memset(&st,0,sizeof(st));
+	while((opt=getopt(argc,argv,"j:v"))!=-1){
+		if(opt=='j') nthreads=atol(optarg);
+		else if(opt=='v') st.verbose=1;
+		else{
+			fprintf(stderr,"usage: %s [-j threads] [-v] image\n",argv[0]);
+			return 2;
+		}
+	}if(optind!=argc-1){
+		fprintf(stderr,"usage: %s [-j threads] [-v] image\n",argv[0]);
+		return 2;
+	}if(nthreads<1) nthreads=1;
+
+	if((fd=open(argv[optind],O_RDONLY))<0 || fstat(fd,&sb)!=0){
+		perror("Cannot open image");
+		return 2;
+	}if((size_t)sb.st_size<2*BLKSZ){
+		fprintf(stderr,"Image too small\n");
+		return 2;
+	}fsptr=mmap(NULL,sb.st_size,PROT_READ,MAP_SHARED,fd,0);
+	if(fsptr==MAP_FAILED){
+		perror("Cannot map image");
+		return 2;
+	}madvise(fsptr,sb.st_size,MADV_WILLNEED);
+
+	fshead=fsptr;
+	if(fshead->magic!=FS_MAGIC && (fshead->magic==MAGIC_WIDE || fshead->magic==MAGIC_COMPACT)){
+		printf("Image is in the %s format, check it with fsck built %s MYFS_COMPACT\n",
+			(fshead->magic==MAGIC_COMPACT)?"compact":"wide",(fshead->magic==MAGIC_COMPACT)?"with":"without");
+		return 2;
+	}if(fshead->magic!=FS_MAGIC && ((fshead->magic>>16)==(FS_MAGIC>>16)
+		|| (fshead->magic==0 && fshead->size!=0))){
+		printf("Image has an older layout, it cannot be checked or mounted by this build\n");
+		return 2;
+	}if(fshead->magic!=FS_MAGIC && fshead->magic!=0){
+		printf("Bad header: magic %016lx is not that of either format\n",(unsigned long)fshead->magic);
+		return 1;
+	}if(fshead->size==0){
+		printf("Image is empty (never mounted)\n");
+		return 0;
+	}if(fshead->size!=(size_t)sb.st_size/BLKSZ || fshead->ntsize==0 || fshead->ntsize>=fshead->size
+		|| fshead->nodetbl!=sizeof(inode) || fshead->free>fshead->size){
+		printf("Bad header: %lu blocks (image holds %lu), node table of %lu blocks @ %lu, %lu free\n",
+			(size_t)fshead->size,(size_t)sb.st_size/BLKSZ,(size_t)fshead->ntsize,fshead->nodetbl,(size_t)fshead->free);
+		return 1;
+	}
+
+	timespec_get(&t0,TIME_UTC);
+	st.fsptr=fsptr;
+	st.nodect=fshead->ntsize*NODES_BLOCK-1;
+	st.used=calloc(CLDIV(fshead->size,64),sizeof(uint64_t));
+	st.freed=calloc(CLDIV(fshead->size,64),sizeof(uint64_t));
+	st.refs=calloc(st.nodect,sizeof(size_t));
+	st.parent=calloc(st.nodect,sizeof(nodei));
+	threads=calloc(nthreads,sizeof(pthread_t));
+	if(st.used==NULL || st.freed==NULL || st.refs==NULL || st.parent==NULL || threads==NULL){
+		fprintf(stderr,"Out of memory\n");
+		return 2;
+	}pthread_mutex_init(&st.report_lock,NULL);
+
+	for(i=0;i<nthreads;i++){
+		if(pthread_create(&threads[i],NULL,worker,&st)!=0){
+			nthreads=i;
+			break;
+		}
+	}if(nthreads==0) worker(&st);
+	for(i=0;i<nthreads;i++) pthread_join(threads[i],NULL);
+	checkblocks(&st);
+	checklinks(&st);
+	checkorphans(&st);
+	if(st.reserved!=fshead->reserved){
+		report(&st,"header: %lu blocks reserved past the end of files, header says %lu",st.reserved,(size_t)fshead->reserved);
+	}timespec_get(&t1,TIME_UTC);
+
+	printf("\n%lu blocks of %lu bytes, node table %lu blocks (%lu nodes)\n",(size_t)fshead->size,BLKSZ,(size_t)fshead->ntsize,st.nodect);
+	printf("%lu files in %lu blocks, %lu directories in %lu blocks, %lu offset blocks, %lu orphans\n",
+		st.files,st.fileblks,st.dirs,st.dirblks,st.offblks,st.orphans);
+	printf("%lu orphans pending on the orphan list with %lu blocks still to free\n",st.pending,st.pendblks);
+	printf("%lu free blocks in %lu regions (%.1f%% free), %lu reserved past the end of files\n",st.freeblks,
+		st.freeregs,100.0*st.freeblks/fshead->size,st.reserved);
+	printf("%lu of %lu nonempty files fragmented, %.2f extents per file\n\n",st.fragged,st.files,
+		(st.files)?(double)st.extents/st.files:0.0);
+	hist_print("Free regions by size","blocks",st.freehist);
+	hist_print("Files by extent count","extents",st.fraghist);
+	printf("\nChecked with %ld threads in %.3fs: %lu errors\n",nthreads,
+		(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9,st.errors);
+
+	munmap(fsptr,sb.st_size);
+	close(fd);
+	return (st.errors)?1:0;
+}
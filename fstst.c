@@ -19,7 +19,8 @@ void printdir(void *fsptr, nodei dir, size_t level)
 {
 	fsheader *fshead=fsptr;
 	inode *nodetbl=O2P(fshead->nodetbl);
-	blkset oblk=NULLOFF, dblk=nodetbl[dir].blocks[0];
+	nodemap *maptbl=NODEMAP(fshead);
+	blkset oblk=NULLOFF, dblk=maptbl[dir].blocks[0];
 	direntry *df;
 	blkdex block=0, entry=0;
 	fpos pos;
@@ -39,6 +40,7 @@ void printnodes(void *fsptr)
 {
 	fsheader *fshead=fsptr;
 	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
 	size_t nodect,j,k;
 	nodei i;
 	
@@ -49,17 +51,17 @@ void printnodes(void *fsptr)
 	for(i=0;i<nodect;i++){
 		printf("\tNode %ld, ",i);
 		if(nodetbl[i].nlinks){
-			blkset offb=nodetbl[i].blocklist;
+			blkset offb=maptbl[i].blocklist;
 			size_t unit=1;
 			if(nodetbl[i].mode==DIRMODE){
 				printf("directory, ");
 				unit=sizeof(direntry);
 			}else if(nodetbl[i].mode==FILEMODE) printf("regular file, ");
 			else printf("mode not set, ");
-			printf("%ld links, %ld bytes in %ld blocks\n",nodetbl[i].nlinks,nodetbl[i].size*unit,nodetbl[i].nblocks);
+			printf("%ld links, %ld bytes in %ld blocks\n",(long)nodetbl[i].nlinks,(long)(nodetbl[i].size*unit),(long)maptbl[i].nblocks);
 			for(j=0;j<OFFS_NODE;j++){
-				if(nodetbl[i].blocks[j]==NULLOFF) break;
-				printf("\t\tBlock @ %ld in node list\n",nodetbl[i].blocks[j]);
+				if(maptbl[i].blocks[j]==NULLOFF) break;
+				printf("\t\tBlock @ %ld in node list\n",maptbl[i].blocks[j]);
 			}for(k=0;offb!=NULLOFF;k++){
 				offblock *oblk=B2P(offb);
 				for(j=0;j<BLKSZ-1;j++){
@@ -113,7 +115,7 @@ void test_allocation(void *fsptr)
 	blkset b[4];
 	
 	printfree(fsptr);
-	printf("allocated: %ld", blkalloc(fsptr,4,b));
+	printf("allocated: %ld", blkalloc(fsptr,4,b,ALLOC_ZERO,NULLOFF));
 	printfree(fsptr);
 	printf("freed: %ld", blkfree(fsptr,2,&(b[1])));
 	printfree(fsptr);
@@ -222,11 +224,11 @@ void test_frealloc(void *fsptr)
 	nodetbl[1].mode=FILEMODE;
 	nodetbl[1].size*=sizeof(direntry);
 	printfs(fsptr);
-	printf("resize: %d\n",frealloc(fsptr,1,1*1024));
+	printf("resize: %d\n",frealloc(fsptr,1,1*1024,NULLOFF));
 	printfs(fsptr);
-	printf("resize: %d\n",frealloc(fsptr,1,2*1024));
+	printf("resize: %d\n",frealloc(fsptr,1,2*1024,NULLOFF));
 	printfs(fsptr);
-	printf("resize: %d\n",frealloc(fsptr,1,0*1024));
+	printf("resize: %d\n",frealloc(fsptr,1,0*1024,NULLOFF));
 	printfs(fsptr);
 }
 void test_seek(void *fsptr)
@@ -268,7 +270,7 @@ void test_seek(void *fsptr)
 	while(pos.data!=NULLOFF){
 		printpos(pos);
 		printf("advancement: %ld\n",seek(fsptr,&pos,2));
-		//printf("advancement: %ld\n",advance(fsptr,&pos,nodetbl[0].nblocks));
+		//printf("advancement: %ld\n",advance(fsptr,&pos,maptbl[0].nblocks));
 	}
 	printpos(pos);
 }
@@ -217,35 +217,361 @@
 
 */
 
+#include <limits.h>
+#include <linux/falloc.h>
+
 #include "myfs_helper.h"
+#include "myfs_probes.h"
 
 /*Implementation Details
 	Filesystem layout
-		[ global header | root inode | ... inodes ... ] [ node table blocks ]... [ data blocks ]...
+		[ global header | root inode | ... inodes ... | root map | ... maps ... ] [ data blocks ]...
 	File layout
-		node{ first n data offsets }->first offset block{ next m data offsets }->...
+		map{ first n data offsets }->first offset block{ next m data offsets }->...
 	Directory layout
 		{ file0[node,name] file1[node,name] ... } ... { file_n[node,name] file_n+1[node,name] ... }
 	
 	Block sizes were chosen to be 1024 bytes, as this is a common block size, is smaller than the page size, and is big enough to contain most small files
 	Names are given a fixed length to reduce complexity, and the length is such that a directory entry is 256 bytes
 		when/if a longer name is given, the name will be truncated to the fixed length
+	Each directory entry stores its name's length and 32-bit FNV-1a hash, so a scan compares one integer per entry
+		and reads the name only on a hash match, path components are measured and compared 16 or 32 bytes at a
+		time with SSE2 or AVX2 when the build targets them
+	Lookups that find nothing are remembered per directory and name in a fixed negative cache in myfs_helper.c,
+		so the repeated stats of missing paths by build tools and module loaders return without a directory scan,
+		the slot of a name is dropped whenever dirmod adds or renames that name into the directory
 	The number of Inodes allocated to the filesystem is calculated so there are at least as many nodes as there
 		is space for the number of 4k files that can fit after the node table
 	Inodes store the same data for files as for directories, only sizes are interpreted differently,
 		and the mode is set appropriately to distinguish between them
 	No empty offset, data, or directory blocks are allocated, empty dirs and files of size 0 have 0 blocks
 	Free blocks are stored in a linked list and grouped into contiguous regions
+	Allocations name a goal block: files grow from the block after their last one, empty files start after their
+		parent directory's last block, and directories after their own, so files stay physically sequential
+	Data blocks are not zeroed when allocated: each file keeps a valid size, and bytes between it and the file size
+		read as zeros whatever their blocks hold, so extending by truncate costs no writes and appends write once,
+		only a write starting past the valid size zeroes the gap before it
+	Reads and writes copy a run of blocks that follow each other on disk at a time, one memcpy for a contiguous
+		request however large, the file is grown once to the end of a write before copying
+	myfs.c buffers appends per file outside the image and writes them here in one piece on fsync, release, pressure
+		or after a few seconds, so blocks are allocated once the extent is known, and not at all for files removed first
+	fallocate maps whole runs from the allocator without writing them, punching a hole frees the blocks and marks
+		their map slots HOLE, which read as zeros and get a block again when written
+	Appending writes reserve blocks past the end of the file, as many again as it has up to PREALLOC_MAX, so a file
+		written sequentially grows in a few large contiguous runs instead of one allocation per write,
+		the reservation is released on release and fsync, and from every file when the free list runs dry,
+		statfs counts reserved blocks as free
+	Unlinking a file or truncating away at least ORPHAN_MIN blocks does not free them: the node, or a new node given
+		the offblocks past the new end, goes on an orphan list kept in the header, and myfs.c frees it a batch at
+		a time from a background thread, or all at once when space runs out, mounting picks up where it stopped
+	With --defrag a background thread moves the blocks of fragmented files into one run, a bounded number of
+		blocks at a time under the filesystem lock: a file grows in place when the free run after its first
+		extent is long enough, otherwise it moves whole to the smallest free region that fits it
 	Testing was done similarly to HW3, using a separate file to test helper functions before working with FUSE
 	Valgrind was used to check for memory leaks and seemed to find none, though some were reported and appear to
 		result from FUSE
-	Certain functions were implemented inefficiently near the deadline and perfom noticably slowly under load,
-		notably frealloc, as used for truncates
+	Resizing a file walks its offblock chain once to the boundary, then allocates in batches of consecutive blocks
+		or frees in sorted batches of up to FREE_BATCH, so a truncate costs what it changes and not the file size,
+		and positioning in a file computes the slot from the block number instead of stepping block by block
+	Building with FORMAT=compact (MYFS_COMPACT) uses 32-bit block and node numbers and nanosecond timestamps,
+		which shrinks the block maps and doubles what an offblock maps, a magic number in the header records the
+		format of an image and mounting or checking an image of the other format is refused
+	The node table is split in two arrays indexed by node: the inodes hold only the attributes stat and path
+		lookup read, 64 bytes so each is one aligned cache line, and the block maps follow them, only touched by
+		I/O and resizing, a stat storm over many files reads one line per file and walks the table in order
+	Per-thread operation counters and latency histograms are kept in myfs_stats.c, for the FUSE callbacks and the
+		helpers path2node, dirmod, blkalloc, blkfree, frealloc and seek, and are readable through /.myfs/stats
+	Each operation is written once against nodes (nodemake, nodeunlink, nodewrite, ...), the path functions
+		resolve their path and call it, and the node functions below serve the --lowlevel frontend of myfs.c,
+		which hands the kernel node numbers as inode numbers and keeps unlinked files until their last forget
+	myfs.c runs its own session loop: one thread reads requests and queues them by class, metadata or data, for a
+		pool of --workers threads that takes metadata first and keeps one worker free of data requests
+	With --trace every FUSE operation is recorded to a ring buffer file by myfs_trace.c, which replay.c feeds back
+		into these functions against a copy of an image
+	Static tracepoints (myfs_probes.h) mark the allocator, directory, lookup, resize and read/write paths, they are
+		USDT probes in the probes build and compile to nothing otherwise
 	The helper functions are implemented in the separate file myfs_helper.c, and filesystem types and definintions
 		are in myfs_helper.h
-	A makefile was made to build the project, with targets default(fuse version), debug(for gdb), and test(fstst.c)
+	A makefile was made to build the project, with targets default(fuse version), debug(for gdb),
+		probes(with USDT tracepoints), test(fstst.c),
+		fsck(offline image checker, fsck.c), bench(in-process benchmark of the implementation, bench.c),
+		and replay(replays a trace against an image, replay.c)
+*/
+
+/* Allocation goal for the first blocks of the file at path: a file with blocks grows after its last one anyway,
+	an empty file starts next to its parent directory's blocks, or anywhere when path is NULL
+*/
+static blkset filegoal(void *fsptr, const char *path, nodei node)
+{
+	fsheader *fshead=fsptr;
+	nodemap *maptbl=NODEMAP(fshead);
+	const char *fname;
+	nodei pnode;
+	
+	if(maptbl[node].nblocks>0 || path==NULL || (pnode=path2node(fsptr,path,&fname))==NONODE) return NULLOFF;
+	return nodegoal(fsptr,pnode);
+}
+
+/* Node Cores
+	The work of each operation once its path is resolved, shared by the path implementations and the node
+	implementations below, path only serves the allocation goal of an empty file and may be NULL
 */
 
+static int nodeattr(void *fsptr, uid_t uid, gid_t gid, nodei node, struct stat *stbuf)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	size_t unit=1;
+	
+	if(nodetbl[node].mode==DIRMODE) unit=sizeof(direntry);
+	stbuf->st_uid=uid;
+	stbuf->st_gid=gid;
+	stbuf->st_mode=nodetbl[node].mode;
+	stbuf->st_size=nodetbl[node].size*unit;
+	stbuf->st_nlink=nodetbl[node].nlinks;
+	stbuf->st_atim=NT2TS(nodetbl[node].atime);
+	stbuf->st_mtim=NT2TS(nodetbl[node].mtime);
+	stbuf->st_ctim=NT2TS(nodetbl[node].ctime);
+	return 0;
+}
+
+//lists the names of dir, and their nodes too if nodesptr is not NULL, nothing is allocated for an empty dir
+static int dirlist(void *fsptr, int *errnoptr, nodei dir, char ***namesptr, uint64_t **nodesptr)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	direntry *df;
+	fpos pos;
+	struct timespec access;
+	size_t count=0;
+	char **namelist;
+	uint64_t *nodes=NULL;
+	
+	if(nodetbl[dir].mode!=DIRMODE){
+		*errnoptr=ENOTDIR;
+		return -1;
+	}
+	
+	timespec_get(&access,TIME_UTC);
+	nodetbl[dir].atime=TS2NT(access);
+	
+	if(nodetbl[dir].size==0) return 0;
+	if((namelist=malloc(nodetbl[dir].size*sizeof(char*)))==NULL ||
+		(nodesptr!=NULL && (nodes=malloc(nodetbl[dir].size*sizeof(uint64_t)))==NULL)){
+		free(namelist);
+		*errnoptr=EINVAL;
+		return -1;
+	}
+	
+	loadpos(fsptr,&pos,dir);
+	while(pos.data!=NULLOFF){
+		df=(direntry*)B2P(pos.dblk);
+		if(df[pos.dpos].node==NONODE) break;
+		namelist[count]=(char*)malloc(df[pos.dpos].len+1);
+		if(namelist[count]==NULL){
+			while(count) free(namelist[--count]);
+			free(namelist);
+			free(nodes);
+			*errnoptr=EINVAL;
+			return -1;
+		}memcpy(namelist[count],df[pos.dpos].name,df[pos.dpos].len+1);
+		if(nodes!=NULL) nodes[count]=df[pos.dpos].node;
+		count++;
+		seek(fsptr,&pos,1);
+	}*namesptr=namelist;
+	if(nodesptr!=NULL) *nodesptr=nodes;
+	return count;
+}
+
+static int nodemake(void *fsptr, int *errnoptr, nodei pnode, const char *fname, uint16_t mode, nodei *nodeptr)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	struct timespec creation;
+	nodei node;
+	
+	if((node=newnode(fsptr))==NONODE){
+		*errnoptr=ENOSPC;
+		return -1;
+	}if(dirmod(fsptr,pnode,fname,node,NULL)==NONODE){
+		*errnoptr=EEXIST;
+		return -1;
+	}
+	
+	timespec_get(&creation,TIME_UTC);
+	nodetbl[node].mode=mode;
+	nodetbl[node].ctime=TS2NT(creation);
+	nodetbl[node].mtime=TS2NT(creation);
+	if(nodeptr!=NULL) *nodeptr=node;
+	return 0;
+}
+
+//removes fname from pnode, with keep an unlinked file keeps its blocks until __myfs_forget_implem
+static int nodeunlink(void *fsptr, int *errnoptr, nodei pnode, const char *fname, int keep, nodei *nodeptr)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodei node;
+	
+	if((node=dirmod(fsptr,pnode,fname,0,""))==NONODE){
+		*errnoptr=EEXIST;
+		return -1;
+	}if(!keep && nodetbl[node].nlinks==0 && forphan(fsptr,node,0)==0){
+		frealloc(fsptr,node,0,NULLOFF);
+	}if(keep && nodetbl[node].nlinks==0 && nodetbl[node].mode==FILEMODE){
+		nodetbl[node].flags|=NODE_OPEN;
+	}if(nodeptr!=NULL) *nodeptr=node;
+	return 0;
+}
+
+static int nodemove(void *fsptr, int *errnoptr, nodei pfrom, const char *ffrom, nodei pto, const char *fto)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	struct timespec modify;
+	nodei file;
+	
+	if((file=dirmod(fsptr,pfrom,ffrom,NONODE,NULL))==NONODE){
+		*errnoptr=ENOENT;
+		return -1;
+	}
+	
+	timespec_get(&modify,TIME_UTC);
+	nodetbl[file].mtime=TS2NT(modify);
+	
+	if(pto==pfrom){
+		if(dirmod(fsptr,pfrom,ffrom,NONODE,fto)==NONODE){
+			*errnoptr=EEXIST;
+			return -1;
+		}return 0;
+	}
+	
+	if(dirmod(fsptr,pto,fto,file,NULL)==NONODE){
+		*errnoptr=EEXIST;
+		return -1;
+	}if(dirmod(fsptr,pfrom,ffrom,0,"")==NONODE){
+		dirmod(fsptr,pto,fto,0,"");
+		*errnoptr=EACCES;
+		return -1;
+	}return 0;
+}
+
+static int nodetrunc(void *fsptr, int *errnoptr, nodei node, off_t offset, const char *path)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	struct timespec modify;
+	
+	if(nodetbl[node].mode!=FILEMODE){
+		*errnoptr=EISDIR;
+		return -1;
+	}
+	
+	timespec_get(&modify,TIME_UTC);
+	nodetbl[node].mtime=TS2NT(modify);
+	
+	if(offset>=0 && (size_t)offset<nodetbl[node].size) forphan(fsptr,node,offset);
+	if(frealloc(fsptr,node,offset,filegoal(fsptr,path,node))==-1){
+		*errnoptr=EPERM;
+		return -1;
+	}return 0;
+}
+
+static int noderead(void *fsptr, int *errnoptr, nodei node, char *buf, size_t size, off_t off)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	size_t readct, validct;
+	struct timespec access;
+	
+	if(nodetbl[node].mode!=FILEMODE){
+		*errnoptr=EISDIR;
+		return -1;
+	}if(off<0){
+		*errnoptr=EINVAL;
+		return -1;
+	}if(size==0 || (size_t)off>=nodetbl[node].size) return 0;
+
+	timespec_get(&access,TIME_UTC);
+	nodetbl[node].atime=TS2NT(access);
+	
+	readct=MIN(size,nodetbl[node].size-off);
+	validct=(maptbl[node].vsize>(size_t)off)?MIN(readct,maptbl[node].vsize-off):0;
+	fileio(fsptr,node,off,buf,validct,IO_READ);
+	memset(buf+validct,0,readct-validct);
+	MYFS_PROBE3(read,node,readct,(off+readct-1)/BLKSZ-off/BLKSZ+1);
+	return readct;
+}
+
+static int nodewrite(void *fsptr, int *errnoptr, nodei node, const char *buf, size_t size, off_t off,
+	const char *path)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	struct timespec modify;
+	size_t writect, end;
+	
+	if(nodetbl[node].mode!=FILEMODE){
+		*errnoptr=EISDIR;
+		return -1;
+	}if(off<0){
+		*errnoptr=EINVAL;
+		return -1;
+	}
+	
+	timespec_get(&modify,TIME_UTC);
+	nodetbl[node].mtime=TS2NT(modify);
+	
+	if(size==0) return 0;
+	end=off+size;
+	//appends reserve blocks past the end with fextend, a write leaving a gap past the end is not streaming
+	if(end>nodetbl[node].size && ((size_t)off<=nodetbl[node].size?
+		fextend(fsptr,node,end,filegoal(fsptr,path,node)):frealloc(fsptr,node,end,filegoal(fsptr,path,node)))==-1){
+		*errnoptr=ENOSPC;
+		return -1;
+	}//the gap between the written data and the write becomes valid, so it is the only part ever zeroed
+	if((size_t)off>maptbl[node].vsize){
+		fileio(fsptr,node,maptbl[node].vsize,NULL,off-maptbl[node].vsize,IO_ZERO);
+	}writect=fileio(fsptr,node,off,(char*)buf,size,IO_WRITE);
+	if(off+writect>maptbl[node].vsize) maptbl[node].vsize=off+writect;
+	MYFS_PROBE3(write,node,writect,(writect>0)?(off+writect-1)/BLKSZ-off/BLKSZ+1:0);
+	return writect;
+}
+
+static int nodefalloc(void *fsptr, int *errnoptr, nodei node, int mode, off_t off, off_t len, const char *path)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	struct timespec modify;
+	int keep=(mode&FALLOC_FL_KEEP_SIZE)!=0;
+	
+	if(off<0 || len<=0){
+		*errnoptr=EINVAL;
+		return -1;
+	}if((mode&~(FALLOC_FL_KEEP_SIZE|FALLOC_FL_PUNCH_HOLE)) || ((mode&FALLOC_FL_PUNCH_HOLE) && !keep)){
+		*errnoptr=EOPNOTSUPP;
+		return -1;
+	}if((size_t)off+len<(size_t)off){
+		*errnoptr=EFBIG;
+		return -1;
+	}if(nodetbl[node].mode!=FILEMODE){
+		*errnoptr=ENODEV;
+		return -1;
+	}
+	
+	if(mode&FALLOC_FL_PUNCH_HOLE) fpunch(fsptr,node,off,len);
+	else if(fpalloc(fsptr,node,off,len,keep,filegoal(fsptr,path,node))==-1){
+		*errnoptr=ENOSPC;
+		return -1;
+	}if(!keep || (mode&FALLOC_FL_PUNCH_HOLE)){
+		timespec_get(&modify,TIME_UTC);
+		nodetbl[node].mtime=TS2NT(modify);
+	}
+	return 0;
+}
+
 /* FUSE Function Implementations */
 
 /* Implements an emulation of the stat system call on the filesystem 
@@ -277,28 +603,14 @@
 int __myfs_getattr_implem(void *fsptr, size_t fssize, int *errnoptr,
                           uid_t uid, gid_t gid,
                           const char *path, struct stat *stbuf) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
 	nodei node;
-	size_t unit=1;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=(inode*)O2P(fshead->nodetbl);
 	
 	if((node=path2node(fsptr,path,NULL))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if(nodetbl[node].mode==DIRMODE) unit=sizeof(direntry);
-	
-	stbuf->st_uid=uid;
-	stbuf->st_gid=gid;
-	stbuf->st_mode=nodetbl[node].mode;
-	stbuf->st_size=nodetbl[node].size*unit;
-	stbuf->st_nlink=nodetbl[node].nlinks;
-	stbuf->st_atim=nodetbl[node].atime;
-	stbuf->st_mtim=nodetbl[node].mtime;
-	stbuf->st_ctim=nodetbl[node].ctime;
-	return 0;
+	}return nodeattr(fsptr,uid,gid,node,stbuf);
 }
 
 /* Implements an emulation of the readdir system call on the filesystem 
@@ -339,47 +651,14 @@ int __myfs_getattr_implem(void *fsptr, size_t fssize, int *errnoptr,
 */
 int __myfs_readdir_implem(void *fsptr, size_t fssize, int *errnoptr,
                           const char *path, char ***namesptr) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
-	direntry *df;
 	nodei dir;
-	fpos pos;
-	struct timespec access;
-	size_t count=0;
-	char **namelist;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=O2P(fshead->nodetbl);
 	
 	if((dir=path2node(fsptr,path,NULL))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if(nodetbl[dir].mode!=DIRMODE){
-		*errnoptr=ENOTDIR;
-		return -1;
-	}if((namelist=malloc(nodetbl[dir].size*sizeof(char*)))==NULL){
-		*errnoptr=EINVAL;
-		return -1;
-	}
-	
-	timespec_get(&access,TIME_UTC);
-	nodetbl[dir].atime=access;
-	
-	loadpos(fsptr,&pos,dir);
-	while(pos.data!=NULLOFF){
-		df=(direntry*)B2P(pos.dblk);
-		if(df[pos.dpos].node==NONODE) break;
-		namelist[count]=(char*)malloc(strlen(df[pos.dpos].name));
-		if(namelist[count]==NULL){
-			while(count) free(namelist[--count]);
-			free(namelist);
-			*errnoptr=EINVAL;
-			return -1;
-		}strcpy(namelist[count],df[pos.dpos].name);
-		count++;
-		seek(fsptr,&pos,1);
-	}*namesptr=namelist;
-	return count;
+	}return dirlist(fsptr,errnoptr,dir,namesptr,NULL);
 }
 
 /* Implements an emulation of the mknod system call for regular files
@@ -400,31 +679,15 @@ int __myfs_readdir_implem(void *fsptr, size_t fssize, int *errnoptr,
 
 */
 int __myfs_mknod_implem(void *fsptr, size_t fssize, int *errnoptr, const char *path) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
-	nodei pnode, node;
-	struct timespec creation;
+	nodei pnode;
 	const char *fname;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=(inode*)O2P(fshead->nodetbl);
 	
 	if((pnode=path2node(fsptr,path,&fname))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if((node=newnode(fsptr))==NONODE){
-		*errnoptr=ENOSPC;
-		return -1;
-	}if(dirmod(fsptr,pnode,fname,node,NULL)==NONODE){
-		*errnoptr=EEXIST;
-		return -1;
-	}
-	
-	timespec_get(&creation,TIME_UTC);
-	nodetbl[node].mode=FILEMODE;
-	nodetbl[node].ctime=creation;
-	nodetbl[node].mtime=creation;
-	return 0;
+	}return nodemake(fsptr,errnoptr,pnode,fname,FILEMODE,NULL);
 }
 
 /* Implements an emulation of the unlink system call for regular files
@@ -440,23 +703,15 @@ int __myfs_mknod_implem(void *fsptr, size_t fssize, int *errnoptr, const char *p
 
 */
 int __myfs_unlink_implem(void *fsptr, size_t fssize, int *errnoptr, const char *path) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
-	nodei pnode, node;
+	nodei pnode;
 	const char *fname;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=(inode*)O2P(fshead->nodetbl);
 	
 	if((pnode=path2node(fsptr,path,&fname))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if((node=dirmod(fsptr,pnode,fname,0,""))==NONODE){
-		*errnoptr=EEXIST;
-		return -1;
-	}if(nodetbl[node].nlinks==0){
-		frealloc(fsptr,node,0);
-	}return 0;
+	}return nodeunlink(fsptr,errnoptr,pnode,fname,0,NULL);
 }
 
 /* Implements an emulation of the rmdir system call on the filesystem 
@@ -483,10 +738,7 @@ int __myfs_rmdir_implem(void *fsptr, size_t fssize, int *errnoptr, const char *p
 	if((pnode=path2node(fsptr,path,&fname))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if(dirmod(fsptr,pnode,fname,0,"")==NONODE){
-		*errnoptr=EEXIST;
-		return -1;
-	}return 0;
+	}return nodeunlink(fsptr,errnoptr,pnode,fname,1,NULL);
 }
 
 /* Implements an emulation of the mkdir system call on the filesystem 
@@ -502,31 +754,15 @@ int __myfs_rmdir_implem(void *fsptr, size_t fssize, int *errnoptr, const char *p
 
 */
 int __myfs_mkdir_implem(void *fsptr, size_t fssize, int *errnoptr, const char *path) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
-	struct timespec creation;
-	nodei pnode, node;
+	nodei pnode;
 	const char *fname;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=(inode*)O2P(fshead->nodetbl);
 
 	if((pnode=path2node(fsptr,path,&fname))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if((node=newnode(fsptr))==NONODE){
-		*errnoptr=ENOSPC;
-		return -1;
-	}if(dirmod(fsptr,pnode,fname,node,NULL)==NONODE){
-		*errnoptr=EEXIST;
-		return -1;
-	}
-
-	timespec_get(&creation,TIME_UTC);
-	nodetbl[node].mode=DIRMODE;
-	nodetbl[node].ctime=creation;
-	nodetbl[node].mtime=creation;
-	return 0;
+	}return nodemake(fsptr,errnoptr,pnode,fname,DIRMODE,NULL);
 }
 
 /* Implements an emulation of the rename system call on the filesystem 
@@ -547,14 +783,10 @@ int __myfs_mkdir_implem(void *fsptr, size_t fssize, int *errnoptr, const char *p
 */
 int __myfs_rename_implem(void *fsptr, size_t fssize, int *errnoptr,
                          const char *from, const char *to) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
-	nodei pfrom, pto, file;
-	struct timespec modify;
+	nodei pfrom, pto;
 	const char *ffrom, *fto;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=(inode*)O2P(fshead->nodetbl);
 	
 	if((pfrom=path2node(fsptr,from,&ffrom))==NONODE){
 		*errnoptr=ENOENT;
@@ -562,29 +794,7 @@ int __myfs_rename_implem(void *fsptr, size_t fssize, int *errnoptr,
 	}if((pto=path2node(fsptr,to,&fto))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if((file=dirmod(fsptr,pfrom,ffrom,NONODE,NULL))==NONODE){
-		*errnoptr=ENOENT;
-		return -1;
-	}
-	
-	timespec_get(&modify,TIME_UTC);
-	nodetbl[file].mtime=modify;
-	
-	if(pto==pfrom){
-		if(dirmod(fsptr,pfrom,ffrom,NONODE,fto)==NONODE){
-			*errnoptr=EEXIST;
-			return -1;
-		}return 0;
-	}
-	
-	if(dirmod(fsptr,pto,fto,file,NULL)==NONODE){
-		*errnoptr=EEXIST;
-		return -1;
-	}if(dirmod(fsptr,pfrom,ffrom,0,"")==NONODE){
-		dirmod(fsptr,pto,fto,0,"");
-		*errnoptr=EACCES;
-		return -1;
-	}return 0;
+	}return nodemove(fsptr,errnoptr,pfrom,ffrom,pto,fto);
 }
 
 /* Implements an emulation of the truncate system call on the filesystem 
@@ -605,29 +815,14 @@ int __myfs_rename_implem(void *fsptr, size_t fssize, int *errnoptr,
 */
 int __myfs_truncate_implem(void *fsptr, size_t fssize, int *errnoptr,
                            const char *path, off_t offset) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
 	nodei node;
-	struct timespec modify;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=(inode*)O2P(fshead->nodetbl);
 	
 	if((node=path2node(fsptr,path,NULL))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if(nodetbl[node].mode!=FILEMODE){
-		*errnoptr=EISDIR;
-		return -1;
-	}
-	
-	timespec_get(&modify,TIME_UTC);
-	nodetbl[node].mtime=modify;
-	
-	if(frealloc(fsptr,node,offset)==-1){
-		*errnoptr=EPERM;
-		return -1;
-	}return 0;
+	}return nodetrunc(fsptr,errnoptr,node,offset,path);
 }
 
 /* Implements an emulation of the open system call on the filesystem 
@@ -671,7 +866,7 @@ int __myfs_open_implem(void *fsptr, size_t fssize, int *errnoptr, const char *pa
 	}
 	
 	timespec_get(&access,TIME_UTC);
-	nodetbl[node].atime=access;
+	nodetbl[node].atime=TS2NT(access);
 	return 0;
 }
 
@@ -692,51 +887,14 @@ int __myfs_open_implem(void *fsptr, size_t fssize, int *errnoptr, const char *pa
 */
 int __myfs_read_implem(void *fsptr, size_t fssize, int *errnoptr,
                        const char *path, char *buf, size_t size, off_t off) {
-
-
-
-   fsheader *fshead=fsptr;
-   inode *nodetbl;
-   nodei node;
-   fpos pos;
-   size_t readct=0, nblks;
-   struct timespec access;
-   
-   fsinit(fsptr,fssize);
-   nodetbl=(inode*)O2P(fshead->nodetbl);
-   
-   if((node=path2node(fsptr,path,NULL))==NONODE){
-      *errnoptr=ENOENT;
-      return -1;
-   }if(nodetbl[node].mode!=FILEMODE){
-      *errnoptr=EISDIR;
-      return -1;
-   }if(size==0) return 0;
-
-   timespec_get(&access,TIME_UTC);
-   nodetbl[node].atime=access;
-   
-   loadpos(fsptr,&pos,node);
-   seek(fsptr,&pos,off);
-   while(pos.data!=NULLOFF && readct<size){
-      char* blk=B2P(pos.dblk);
-      buf[readct++]=blk[pos.dpos];
-      seek(fsptr,&pos,1);
-   }
-   while(readct<size){
-      loadpos(fsptr,&pos,node);
-      seek(fsptr,&pos,off+readct);
-      char* blk=B2P(pos.dblk);
-      buf[readct++]=blk[pos.dpos];
-      seek(fsptr,&pos,1);
-   }
-
-
-
-
-   return readct;
-
-  return -1;
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if((node=path2node(fsptr,path,NULL))==NONODE){
+		*errnoptr=ENOENT;
+		return -1;
+	}return noderead(fsptr,errnoptr,node,buf,size,off);
 }
 
 /* Implements an emulation of the write system call on the filesystem 
@@ -756,52 +914,17 @@ int __myfs_read_implem(void *fsptr, size_t fssize, int *errnoptr,
 */
 int __myfs_write_implem(void *fsptr, size_t fssize, int *errnoptr,
                         const char *path, const char *buf, size_t size, off_t off) {
-	fsheader *fshead=fsptr;
-	inode *nodetbl;
 	nodei node;
-	fpos pos;
-	struct timespec modify;
-	size_t writect=0;
 	
 	fsinit(fsptr,fssize);
-	nodetbl=(inode*)O2P(fshead->nodetbl);
 	
 	if((node=path2node(fsptr,path,NULL))==NONODE){
 		*errnoptr=ENOENT;
 		return -1;
-	}if(nodetbl[node].mode!=FILEMODE){
-		*errnoptr=EISDIR;
-		return -1;
-	}
-	
-	timespec_get(&modify,TIME_UTC);
-	nodetbl[node].mtime=modify;
-	
-	if(size==0) return 0;	
-	if(off>=nodetbl[node].size){
-		size_t offsize=MIN(((off+BLKSZ-1)/BLKSZ)*BLKSZ,(off+size));
-		if(frealloc(fsptr,node,MIN(offsize,(off+size)))==-1){
-			*errnoptr=EINVAL;
-			return -1;
-		}
-	}loadpos(fsptr,&pos,node);
-	seek(fsptr,&pos,off);
-	while(pos.data!=NULLOFF && writect<size){
-		char* blk=B2P(pos.dblk);
-		blk[pos.dpos]=buf[writect++];
-		seek(fsptr,&pos,1);
-	}while(writect<size){
-		if(pos.data==NULLOFF){
-			size_t extsize=MIN((off+size),(nodetbl[node].nblocks+1)*BLKSZ);
-			if(frealloc(fsptr,node,extsize)==-1) break;
-		}loadpos(fsptr,&pos,node);
-		seek(fsptr,&pos,off+writect);
-		char* blk=B2P(pos.dblk);
-		blk[pos.dpos]=buf[writect++];
-		seek(fsptr,&pos,1);
-	}return writect;
+	}return nodewrite(fsptr,errnoptr,node,buf,size,off,path);
 }
 
+
 /* Implements an emulation of the utimensat system call on the filesystem 
    of size fssize pointed to by fsptr.
 
@@ -829,8 +952,8 @@ int __myfs_utimens_implem(void *fsptr, size_t fssize, int *errnoptr,
 		return -1;
 	}
 	
-	nodetbl[node].atime=ts[0];
-	nodetbl[node].mtime=ts[1];
+	nodetbl[node].atime=TS2NT(ts[0]);
+	nodetbl[node].mtime=TS2NT(ts[1]);
 	return 0;
 }
 
@@ -865,8 +988,471 @@ int __myfs_statfs_implem(void *fsptr, size_t fssize, int *errnoptr,
 	
 	stbuf->f_bsize=BLKSZ;
 	stbuf->f_blocks=fshead->size;
-	stbuf->f_bfree=fshead->free;
-	stbuf->f_bavail=fshead->free;
+	stbuf->f_bfree=fshead->free+fshead->reserved;
+	stbuf->f_bavail=fshead->free+fshead->reserved;
 	stbuf->f_namemax=NAMELEN-1;
 	return 0;
 }
+
+/* Called when the last open handle of the file at path is released.
+
+   Releases the blocks reserved past the end of the file while it was
+   appended to, so a closed file holds no more blocks than its size
+   needs.
+
+   On success, 0 is returned.
+
+   On failure, -1 is returned and *errnoptr is set appropriately.
+
+*/
+int __myfs_release_implem(void *fsptr, size_t fssize, int *errnoptr,
+                          const char *path) {
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if((node=path2node(fsptr,path,NULL))==NONODE){
+		*errnoptr=ENOENT;
+		return -1;
+	}ftrim(fsptr,node);
+	return 0;
+}
+
+/* Implements an emulation of the fallocate system call on the filesystem
+   of size fssize pointed to by fsptr.
+
+   With mode 0 the call makes sure the len bytes at offset off of the
+   file indicated by path have blocks, and grows the file to off+len
+   bytes if it is shorter. The new blocks are taken in runs as long as
+   the free list has them and are not written: they read as zeros
+   because they lie past the valid size of the file.
+
+   With FALLOC_FL_KEEP_SIZE the size does not change, blocks past the
+   end are kept for later writes instead of being released on close.
+
+   With FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE the blocks entirely
+   within the range are freed and the range reads as zeros.
+
+   On success, 0 is returned.
+
+   On failure, -1 is returned and *errnoptr is set appropriately.
+
+   The error codes are documented in man 2 fallocate.
+
+*/
+int __myfs_fallocate_implem(void *fsptr, size_t fssize, int *errnoptr,
+                            const char *path, int mode, off_t off, off_t len) {
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if((node=path2node(fsptr,path,NULL))==NONODE){
+		*errnoptr=ENOENT;
+		return -1;
+	}return nodefalloc(fsptr,errnoptr,node,mode,off,len,path);
+}
+
+/* Node Implementations
+
+   The same operations for the low-level frontend in myfs.c, which
+   names files and directories by the node numbers the kernel was
+   given by lookup instead of by path, so no operation walks a path.
+   Entries are given by their parent directory's node and their
+   name, a single component.
+
+   The node numbers are the indices into the node table, the root
+   directory is node 0. A node number that is out of the table, or
+   names a node that is not a file or directory, fails with ESTALE:
+   the kernel may hold on to a node after it was removed.
+
+   Other than that, the calls behave and fail like their path
+   counterparts above, with one exception: unlinking a file through
+   __myfs_unlink_node_implem leaves the node and its blocks to the
+   file, marked NODE_OPEN so newnode passes it over, until
+   __myfs_forget_implem is called, so a file stays usable while the
+   kernel has it open.
+
+*/
+
+//checks node is a node the kernel may name, and the parent dir of an entry when dir is set
+static int nodeok(void *fsptr, int *errnoptr, uint64_t node, int dir)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	
+	if(node>=(uint64_t)(fshead->ntsize*NODES_BLOCK-1) || nodevalid(fsptr,(nodei)node)<NODEI_GOOD ||
+		(nodetbl[node].mode!=DIRMODE && nodetbl[node].mode!=FILEMODE)){
+		*errnoptr=ESTALE;
+		return 0;
+	}if(dir && (nodetbl[node].mode!=DIRMODE || nodetbl[node].nlinks==0)){
+		*errnoptr=(nodetbl[node].mode!=DIRMODE)?ENOTDIR:ENOENT;
+		return 0;
+	}return 1;
+}
+
+/* Looks up name in the directory dir and puts its node into *nodeptr.
+   On success, 0 is returned, on failure -1 with *errnoptr set.
+*/
+int __myfs_lookup_implem(void *fsptr, size_t fssize, int *errnoptr,
+                         uint64_t dir, const char *name, uint64_t *nodeptr) {
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,dir,1)) return -1;
+	if((node=dirmod(fsptr,dir,name,NONODE,NULL))==NONODE){
+		*errnoptr=ENOENT;
+		return -1;
+	}*nodeptr=node;
+	return 0;
+}
+
+int __myfs_getattr_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                               uid_t uid, gid_t gid, uint64_t node, struct stat *stbuf) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	return nodeattr(fsptr,uid,gid,node,stbuf);
+}
+
+/* Like __myfs_readdir_implem, and when nodesptr is not NULL also
+   allocates an array with the node of each name into *nodesptr.
+*/
+int __myfs_readdir_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                               uint64_t dir, char ***namesptr, uint64_t **nodesptr) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,dir,0)) return -1;
+	return dirlist(fsptr,errnoptr,dir,namesptr,nodesptr);
+}
+
+/* Creates the regular file name in dir and puts its node into *nodeptr. */
+int __myfs_mknod_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                             uint64_t dir, const char *name, uint64_t *nodeptr) {
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,dir,1)) return -1;
+	if(nodemake(fsptr,errnoptr,dir,name,FILEMODE,&node)<0) return -1;
+	*nodeptr=node;
+	return 0;
+}
+
+/* Creates the directory name in dir and puts its node into *nodeptr. */
+int __myfs_mkdir_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                             uint64_t dir, const char *name, uint64_t *nodeptr) {
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,dir,1)) return -1;
+	if(nodemake(fsptr,errnoptr,dir,name,DIRMODE,&node)<0) return -1;
+	*nodeptr=node;
+	return 0;
+}
+
+/* Removes the file name from dir and puts its node into *nodeptr. A
+   file left without links keeps its blocks, the caller frees them with
+   __myfs_forget_implem once nothing refers to the node anymore.
+*/
+int __myfs_unlink_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                              uint64_t dir, const char *name, uint64_t *nodeptr) {
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,dir,1)) return -1;
+	if(nodeunlink(fsptr,errnoptr,dir,name,1,&node)<0) return -1;
+	*nodeptr=node;
+	return 0;
+}
+
+int __myfs_rmdir_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                             uint64_t dir, const char *name) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,dir,1)) return -1;
+	return nodeunlink(fsptr,errnoptr,dir,name,1,NULL);
+}
+
+int __myfs_rename_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                              uint64_t dir, const char *name, uint64_t newdir, const char *newname) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,dir,1) || !nodeok(fsptr,errnoptr,newdir,1)) return -1;
+	return nodemove(fsptr,errnoptr,dir,name,newdir,newname);
+}
+
+int __myfs_truncate_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                                uint64_t node, off_t offset) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	return nodetrunc(fsptr,errnoptr,node,offset,NULL);
+}
+
+int __myfs_open_node_implem(void *fsptr, size_t fssize, int *errnoptr, uint64_t node) {
+	fsheader *fshead=fsptr;
+	inode *nodetbl;
+	struct timespec access;
+	
+	fsinit(fsptr,fssize);
+	nodetbl=(inode*)O2P(fshead->nodetbl);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	timespec_get(&access,TIME_UTC);
+	nodetbl[node].atime=TS2NT(access);
+	return 0;
+}
+
+int __myfs_read_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                            uint64_t node, char *buf, size_t size, off_t off) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	return noderead(fsptr,errnoptr,node,buf,size,off);
+}
+
+int __myfs_write_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                             uint64_t node, const char *buf, size_t size, off_t off) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	return nodewrite(fsptr,errnoptr,node,buf,size,off,NULL);
+}
+
+int __myfs_utimens_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                               uint64_t node, const struct timespec ts[2]) {
+	fsheader *fshead=fsptr;
+	inode *nodetbl;
+	
+	fsinit(fsptr,fssize);
+	nodetbl=(inode*)O2P(fshead->nodetbl);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	nodetbl[node].atime=TS2NT(ts[0]);
+	nodetbl[node].mtime=TS2NT(ts[1]);
+	return 0;
+}
+
+int __myfs_release_node_implem(void *fsptr, size_t fssize, int *errnoptr, uint64_t node) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	ftrim(fsptr,node);
+	return 0;
+}
+
+int __myfs_fallocate_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                                 uint64_t node, int mode, off_t off, off_t len) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	return nodefalloc(fsptr,errnoptr,node,mode,off,len,NULL);
+}
+
+/* Called once nothing refers to node anymore. If it is a file that
+   was unlinked, its blocks are freed, or put on the orphan list when
+   there are many.
+
+   On success, 0 is returned, 1 if blocks went to the orphan list.
+   On failure, -1 is returned and *errnoptr is set appropriately.
+*/
+int __myfs_forget_implem(void *fsptr, size_t fssize, int *errnoptr, uint64_t node) {
+	fsheader *fshead=fsptr;
+	inode *nodetbl;
+	
+	fsinit(fsptr,fssize);
+	nodetbl=(inode*)O2P(fshead->nodetbl);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	if(nodetbl[node].nlinks>0 || nodetbl[node].mode!=FILEMODE) return 0;
+	nodetbl[node].flags&=~NODE_OPEN;
+	if(nodetbl[node].flags&NODE_ORPHAN) return 0;
+	if(forphan(fsptr,node,0)>0) return 1;
+	frealloc(fsptr,node,0,NULLOFF);
+	return 0;
+}
+
+/* Implements one step of online defragmentation of the filesystem of
+   size fssize pointed to by fsptr.
+
+   Regular files are visited in node table order starting at
+   *cursor, and the data blocks of a fragmented file are moved until
+   the file is one contiguous run or maxblks blocks have been moved.
+   *cursor is left on the node where the step stopped, so the next
+   call continues there.
+
+   On success, the number of blocks moved is returned, 0 when a whole
+   pass over the node table found nothing to move.
+
+   On failure, -1 is returned and *errnoptr is set appropriately.
+
+   The error codes are: EINVAL when maxblks is 0.
+
+*/
+int __myfs_defrag_implem(void *fsptr, size_t fssize, int *errnoptr,
+                         size_t *cursor, size_t maxblks) {
+	fsheader *fshead=fsptr;
+	size_t nodect, seen, moved=0;
+	
+	fsinit(fsptr,fssize);
+	nodect=fshead->ntsize*NODES_BLOCK-1;
+	
+	if(maxblks==0){
+		*errnoptr=EINVAL;
+		return -1;
+	}if(*cursor>=nodect) *cursor=0;
+	for(seen=0;seen<nodect && moved<maxblks;seen++){
+		moved+=fdefrag(fsptr,*cursor,maxblks-moved);
+		if(moved<maxblks && ++*cursor>=nodect) *cursor=0;
+	}return (int)MIN(moved,(size_t)INT_MAX);
+}
+
+/* Implements one step of freeing the blocks of orphans, unlinked
+   files and the tails of truncated files, on the filesystem of size
+   fssize pointed to by fsptr.
+
+   About maxblks blocks are freed, whole offblocks at a time, starting
+   with the most recently orphaned node.
+
+   On success, the number of blocks freed is returned, 0 when the
+   orphan list is empty.
+
+   On failure, -1 is returned and *errnoptr is set appropriately.
+
+   The error codes are: EINVAL when maxblks is 0.
+
+*/
+int __myfs_reclaim_implem(void *fsptr, size_t fssize, int *errnoptr,
+                          size_t maxblks) {
+	fsinit(fsptr,fssize);
+	
+	if(maxblks==0){
+		*errnoptr=EINVAL;
+		return -1;
+	}return (int)MIN(freclaim(fsptr,MIN(maxblks,(size_t)INT_MAX)),(size_t)INT_MAX);
+}
+
+/* Implements mount-time recovery of orphans on the filesystem of size
+   fssize pointed to by fsptr.
+
+   Unlinked nodes that still hold blocks without being on the orphan
+   list, as left by an unmount in the middle of freeing them before the
+   list existed, are put on it.
+
+   The number of nodes on the orphan list is returned, these are
+   freed by __myfs_reclaim_implem. The call cannot fail.
+
+*/
+int __myfs_recover_implem(void *fsptr, size_t fssize, int *errnoptr) {
+	fsheader *fshead=fsptr;
+	nodemap *maptbl;
+	nodei node;
+	int pending=0;
+	
+	(void)errnoptr;
+	fsinit(fsptr,fssize);
+	maptbl=NODEMAP(fshead);
+	
+	frecover(fsptr);
+	for(node=fshead->orphans;node!=0;node=maptbl[node].next) pending++;
+	return pending;
+}
+
+/* Finds where in the filesystem of size fssize pointed to by fsptr
+   the data of the file at path, or of node for the _node variant,
+   from byte off to off+len lies, for myfs.c to advise the mapping
+   of before it is read.
+
+   The data is described as up to max ranges of bytes from the start
+   of the filesystem, range i being lens[i] bytes from starts[i]. Only
+   data within the file size is described, holes and blocks reserved
+   past the end are left out.
+
+   On success, the number of ranges is returned, 0 when there is no
+   data there. On failure, -1 is returned and *errnoptr is set, with
+   the error codes of read.
+
+*/
+static int nodeextents(void *fsptr, int *errnoptr, nodei node, off_t off, size_t len,
+	size_t *starts, size_t *lens, size_t max)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	blkset first[RUNS_MAX];
+	sz_blk count[RUNS_MAX];
+	size_t runs, k;
+	
+	if(nodetbl[node].mode!=FILEMODE){
+		*errnoptr=EISDIR;
+		return -1;
+	}if(off<0){
+		*errnoptr=EINVAL;
+		return -1;
+	}if((size_t)off>=nodetbl[node].size) return 0;
+	len=MIN(len,nodetbl[node].size-off);
+	runs=fruns(fsptr,node,off,len,first,count,MIN(max,RUNS_MAX));
+	for(k=0;k<runs;k++){
+		starts[k]=first[k]*BLKSZ;
+		lens[k]=count[k]*BLKSZ;
+	}return (int)runs;
+}
+int __myfs_extents_implem(void *fsptr, size_t fssize, int *errnoptr,
+                          const char *path, off_t off, size_t len,
+                          size_t *starts, size_t *lens, size_t max) {
+	nodei node;
+	
+	fsinit(fsptr,fssize);
+	
+	if((node=path2node(fsptr,path,NULL))==NONODE){
+		*errnoptr=ENOENT;
+		return -1;
+	}return nodeextents(fsptr,errnoptr,node,off,len,starts,lens,max);
+}
+int __myfs_extents_node_implem(void *fsptr, size_t fssize, int *errnoptr,
+                               uint64_t node, off_t off, size_t len,
+                               size_t *starts, size_t *lens, size_t max) {
+	fsinit(fsptr,fssize);
+	
+	if(!nodeok(fsptr,errnoptr,node,0)) return -1;
+	return nodeextents(fsptr,errnoptr,node,off,len,starts,lens,max);
+}
+
+/* Implements the mount-time sizing of the metadata region of the
+   filesystem of size fssize pointed to by fsptr.
+
+   A blank image is formatted first. The number of bytes from the
+   start of the image to the end of the node table, which hold the
+   header, the inodes and their maps, is returned, for the caller to
+   prefault.
+
+   This function does not fail; errnoptr is left as is.
+
+*/
+size_t __myfs_metasize_implem(void *fsptr, size_t fssize, int *errnoptr) {
+	fsheader *fshead=fsptr;
+
+	(void)errnoptr;
+	fsinit(fsptr,fssize);
+	return (size_t)fshead->ntsize*BLKSZ;
+}
+
+/* Implements the mount-time format check of the filesystem of size
+   fssize pointed to by fsptr.
+
+   A blank image, or one written by this build's format, is accepted
+   and 0 is returned. An image of the other format, or one that is not
+   a myfs image at all, is refused: -1 is returned and *errnoptr is set.
+
+   The error codes are: EINVAL when the image is of another format or
+   the size does not fit the block numbers of this format.
+
+*/
+int __myfs_check_implem(void *fsptr, size_t fssize, int *errnoptr) {
+	if(!fscheck(fsptr,fssize)){
+		*errnoptr=EINVAL;
+		return -1;
+	}return 0;
+}
@@ -39,6 +39,7 @@
 #define FUSE_USE_VERSION 26
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -50,11 +51,30 @@
 #include <sys/mman.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
 
+#include "myfs_stats.h"
+#include "myfs_trace.h"
 
 struct __myfs_options_struct_t {
         const char *filename;
         const char *size;
+        const char *statslog;
+        const char *trace;
+        const char *tracesize;
+        const char *writeback;
+        const char *defrag;
+        const char *cache;
+        const char *iosize;
+        const char *workload;
+        const char *hugepages;
+        const char *workers;
+        const char *cpus;
+        int wbcache;
+        int prefault;
+        int lowlevel;
         int show_help;
 };
 
@@ -63,6 +83,20 @@ struct __myfs_options_struct_t {
 static const struct fuse_opt __myfs_option_spec[] = {
         OPTION("--backupfile=%s", filename),
         OPTION("--size=%s", size),
+        OPTION("--statslog=%s", statslog),
+        OPTION("--trace=%s", trace),
+        OPTION("--tracesize=%s", tracesize),
+        OPTION("--writeback=%s", writeback),
+        OPTION("--defrag=%s", defrag),
+        OPTION("--cache=%s", cache),
+        OPTION("--iosize=%s", iosize),
+        OPTION("--workload=%s", workload),
+        OPTION("--hugepages=%s", hugepages),
+        OPTION("--prefault", prefault),
+        OPTION("--workers=%s", workers),
+        OPTION("--cpus=%s", cpus),
+        OPTION("--wbcache", wbcache),
+        OPTION("--lowlevel", lowlevel),
         OPTION("-h", show_help),
         OPTION("--help", show_help),
         FUSE_OPT_END
@@ -82,10 +116,51 @@ struct __myfs_environment_struct_t {
   size_t          size;
   int             using_backup;
   int             backup_fd;
+  int             stats_fd;
+  tracebuf        *trace;
+  struct __myfs_wbuf_struct_t *wb_list;
+  size_t          wb_max;
+  size_t          wb_total;
+  int             wb_running;
+  pthread_t       wb_thread;
+  size_t          defrag_rate;
+  size_t          defrag_cursor;
+  int             defrag_running;
+  pthread_t       defrag_thread;
+  int             reclaim_running;
+  pthread_t       reclaim_thread;
+  pthread_cond_t  reclaim_cond;
+  int             bg_stop;
+  pthread_cond_t  bg_cond;
+  size_t          cache_timeout;
+  uint32_t        *ll_gen;
+  uint64_t        *ll_refs;
+  size_t          ll_count;
+  size_t          io_size;
+  int             wbcache;
+  size_t          workers;
+  int             *cpus;
+  size_t          ncpus;
 };
 
 #define MYFS_DEFAULT_SIZE  ((size_t) (128 << 20))   /* 128MB */
 #define MYFS_MIN_SIZE      ((size_t) (2048))        /* 2kB */
+#define MYFS_TRACE_SIZE    ((size_t) (64 << 20))    /* 64MB */
+#define MYFS_WB_SIZE       ((size_t) (4 << 20))     /* 4MB */
+#define MYFS_WB_FILES      16
+#define MYFS_WB_AGE        ((uint64_t) 5000000000)  /* 5s */
+#define MYFS_DEFRAG_TICK   ((long) 100000000)       /* 100ms */
+#define MYFS_DEFRAG_IDLE   10                       /* 10s */
+#define MYFS_RECLAIM_BATCH ((size_t) 4096)          /* 4MB */
+#define MYFS_HUGE_PAGE     ((size_t) (2 << 20))     /* 2MB */
+#define MYFS_HUGE_NONE     0
+#define MYFS_HUGE_THP      1
+#define MYFS_HUGE_TLB      2
+#define MYFS_CACHE_TIMEOUT ((size_t) 60)            /* 60s */
+#define MYFS_IO_SIZE       ((size_t) (1 << 20))     /* 1MB */
+#define MYFS_IO_MIN        ((size_t) 4096)          /* 4kB */
+#define MYFS_WORKERS       ((size_t) 4)
+#define MYFS_CPU_MAX       1024
 
 static int __myfs_parse_size(size_t *size, const char *str) {
   unsigned long long int tmp, t;
@@ -102,14 +177,124 @@ static int __myfs_parse_size(size_t *size, const char *str) {
   return 1;
 }
 
+/* Parses a list of CPUs such as 0-3,8 into a new array of their
+   numbers, in the order given */
+static int __myfs_parse_cpus(int **cpus, size_t *count, const char *str) {
+  unsigned long int lo, hi;
+  size_t n;
+  int *list;
+  char *end;
+
+  if ((list = malloc(MYFS_CPU_MAX * sizeof(int))) == NULL) return 0;
+  n = 0;
+  do {
+    lo = strtoul(str, &end, 10);
+    hi = lo;
+    if ((end != str) && (*end == '-')) {
+      str = end + 1;
+      hi = strtoul(str, &end, 10);
+    }
+    if ((end == str) || (hi < lo) || (hi >= MYFS_CPU_MAX) || (n + (hi - lo) >= MYFS_CPU_MAX)) {
+      free(list);
+      return 0;
+    }
+    for (; lo <= hi; lo++) list[n++] = (int) lo;
+    str = end + 1;
+  } while (*end == ',');
+  if (*end != '\0') {
+    free(list);
+    return 0;
+  }
+  *cpus = list;
+  *count = n;
+  return 1;
+}
+
+int __myfs_check_implem(void *, size_t, int *);
+size_t __myfs_metasize_implem(void *, size_t, int *);
+
+/* Maps an anonymous image of *sizeptr bytes, on the pages huge
+   names: hugetlb takes them from the kernel's reserved pool with
+   MAP_HUGETLB, rounding *sizeptr up to a whole number of them, and
+   falls back to thp when the pool is empty; thp places the image on
+   a huge page boundary and advises MADV_HUGEPAGE, so the kernel
+   backs it with transparent huge pages as they fill; NULL or none
+   maps normal pages. Returns MAP_FAILED when nothing can be mapped */
+static void *__myfs_map_anonymous(size_t *sizeptr, const char *huge) {
+  size_t size, slack, tail, page;
+  char *memory, *aligned;
+  int mode;
+
+  mode = MYFS_HUGE_NONE;
+  if (huge != NULL) {
+    if (strcmp(huge, "hugetlb") == 0) {
+      mode = MYFS_HUGE_TLB;
+    } else if (strcmp(huge, "thp") == 0) {
+      mode = MYFS_HUGE_THP;
+    } else if (strcmp(huge, "none") != 0) {
+      fprintf(stderr, "Cannot parse huge pages, using normal pages\n");
+    }
+  }
+  size = *sizeptr;
+#ifdef MAP_HUGETLB
+  if (mode == MYFS_HUGE_TLB) {
+    size = ((size + MYFS_HUGE_PAGE - 1) / MYFS_HUGE_PAGE) * MYFS_HUGE_PAGE;
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+      *sizeptr = size;
+      return memory;
+    }
+    perror("Cannot map huge pages, using transparent huge pages");
+    size = *sizeptr;
+  }
+#endif
+  if (mode == MYFS_HUGE_NONE)
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  /* Map a huge page more than needed and give back what lies
+     before the first boundary and past the end of the image */
+  memory = mmap(NULL, size + MYFS_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) return MAP_FAILED;
+  aligned = (char *) ((((uintptr_t) memory) + MYFS_HUGE_PAGE - 1) & ~((uintptr_t) (MYFS_HUGE_PAGE - 1)));
+  slack = (size_t) (aligned - memory);
+  page = (size_t) sysconf(_SC_PAGESIZE);
+  tail = ((size + page - 1) / page) * page;
+  if (slack > 0) munmap(memory, slack);
+  if (MYFS_HUGE_PAGE - slack > tail - size) munmap(aligned + tail, MYFS_HUGE_PAGE - slack - (tail - size));
+#ifdef MADV_HUGEPAGE
+  if (madvise(aligned, size, MADV_HUGEPAGE) != 0) {
+    perror("Cannot advise huge pages");
+  }
+#else
+  fprintf(stderr, "This system cannot advise huge pages, using normal pages\n");
+#endif
+  return aligned;
+}
+
+/* Faults in the first len bytes of the image at memory for writing,
+   all at once where the kernel can, else a page at a time */
+static void __myfs_prefault(char *memory, size_t len) {
+  size_t page, k;
+
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(memory, len, MADV_POPULATE_WRITE) == 0) return;
+#endif
+  page = (size_t) sysconf(_SC_PAGESIZE);
+  for (k = 0; k < len; k += page) {
+    ((volatile char *) memory)[k] = ((volatile char *) memory)[k];
+  }
+}
+
 static int __myfs_setup_environment(struct __myfs_environment_struct_t *env, struct __myfs_options_struct_t *opts) {
   int size_specified, using_backup;
+  int err;
   size_t size;
   int fd;
   void *memory;
   off_t off;
   size_t len;
   size_t orig_size;
+  int advice;
 
   /* Handle size */
   if (opts->size != NULL) {
@@ -193,6 +378,9 @@ static int __myfs_setup_environment(struct __myfs_environment_struct_t *env, str
 
   /* Do the mmap */
   if (using_backup) {
+    if ((opts->hugepages != NULL) && (strcmp(opts->hugepages, "none") != 0)) {
+      fprintf(stderr, "Huge pages only back an image without a backup-file, not using them\n");
+    }
     memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     if (memory == MAP_FAILED) {
       perror("Cannot map backup-file into memory");
@@ -205,7 +393,7 @@ static int __myfs_setup_environment(struct __myfs_environment_struct_t *env, str
       return 0;
     }
   } else {
-    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memory = __myfs_map_anonymous(&size, opts->hugepages);
     if (memory == MAP_FAILED) {
       perror("Cannot map in memory");
       if (pthread_mutex_destroy(&(env->env_lock)) != 0) {
@@ -215,6 +403,23 @@ static int __myfs_setup_environment(struct __myfs_environment_struct_t *env, str
     }
   }
 
+  /* Tell the kernel how the image is going to be read: MADV_RANDOM
+     turns off its readahead around faults, leaving it to the
+     handles that see a pattern, MADV_SEQUENTIAL reads ahead far */
+  if (opts->workload != NULL) {
+    advice = MADV_NORMAL;
+    if (strcmp(opts->workload, "random") == 0) {
+      advice = MADV_RANDOM;
+    } else if (strcmp(opts->workload, "sequential") == 0) {
+      advice = MADV_SEQUENTIAL;
+    } else if (strcmp(opts->workload, "normal") != 0) {
+      fprintf(stderr, "Cannot parse workload, using normal\n");
+    }
+    if ((advice != MADV_NORMAL) && (madvise(memory, size, advice) != 0)) {
+      perror("Cannot advise memory map");
+    }
+  }
+
   /* If the original size is different from the current size, we
      changed the filesystem and we need to wipe out the old filesystem
      completely.
@@ -226,6 +431,131 @@ static int __myfs_setup_environment(struct __myfs_environment_struct_t *env, str
       }
     }
   }
+
+  /* Refuse an image written by the other format, the block and node
+     numbers in it cannot be read by this build.
+  */
+  if (using_backup && (__myfs_check_implem(memory, size, &err) < 0)) {
+    fprintf(stderr, "Backup-file is not an image of this build's format\n");
+    if (munmap(memory, size) != 0) {
+      perror("Cannot unmap memory");
+    }
+    if (close(fd) != 0) {
+      perror("Cannot close backup-file");
+    }
+    if (pthread_mutex_destroy(&(env->env_lock)) != 0) {
+      perror("Cannot destroy mutex");
+    }
+    return 0;
+  }
+
+  /* Every operation reads the header and the node table, fault
+     them all in now instead of one page at a time under env_lock */
+  if (opts->prefault) {
+    __myfs_prefault(memory, __myfs_metasize_implem(memory, size, &err));
+  }
+  
+  /* Open the stats log, if any */
+  env->stats_fd = STDERR_FILENO;
+  if (opts->statslog != NULL) {
+    env->stats_fd = open(opts->statslog, O_CREAT | O_WRONLY | O_APPEND, 00644);
+    if (env->stats_fd < 0) {
+      perror("Cannot open stats log, using stderr");
+      env->stats_fd = STDERR_FILENO;
+    }
+  }
+  
+  /* Open the trace, if any. Failing to trace is not fatal
+     either, the filesystem works the same without it.
+  */
+  env->trace = NULL;
+  if ((opts->trace != NULL) && opts->lowlevel) {
+    fprintf(stderr, "Traces record paths, which --lowlevel does not have, not tracing\n");
+  } else if (opts->trace != NULL) {
+    len = MYFS_TRACE_SIZE;
+    if ((opts->tracesize != NULL) && (!__myfs_parse_size(&len, opts->tracesize))) {
+      fprintf(stderr, "Cannot parse trace size indication, using default\n");
+      len = MYFS_TRACE_SIZE;
+    }
+    env->trace = trace_open(opts->trace, len / TRACE_SLOT);
+    if (env->trace == NULL) {
+      perror("Cannot open trace, not tracing");
+    }
+  }
+  
+  /* Size the write-back buffers, 0 turns them off */
+  env->wb_list = NULL;
+  env->wb_total = 0;
+  env->wb_running = 0;
+  env->wb_max = MYFS_WB_SIZE;
+  if ((opts->writeback != NULL) && (!__myfs_parse_size(&(env->wb_max), opts->writeback))) {
+    fprintf(stderr, "Cannot parse write-back size indication, using default\n");
+    env->wb_max = MYFS_WB_SIZE;
+  }
+  
+  /* Set the defragmentation rate in blocks per second, 0 turns it off */
+  env->defrag_running = 0;
+  env->defrag_cursor = 0;
+  env->defrag_rate = 0;
+  if ((opts->defrag != NULL) && (!__myfs_parse_size(&(env->defrag_rate), opts->defrag))) {
+    fprintf(stderr, "Cannot parse defragmentation rate, not defragmenting\n");
+    env->defrag_rate = 0;
+  }
+  env->reclaim_running = 0;
+  env->bg_stop = 0;
+
+  /* Every change to the image comes in through the kernel, which
+     drops what it cached for the nodes an operation touches, so
+     it can keep attributes and names much longer than FUSE's
+     default of a second. Nothing is sent back to invalidate them:
+     the high-level API has no notifications, and in the low-level
+     frontend a write, truncate, utimens, rename or unlink only
+     changes what the kernel sent it for and already dropped, while
+     invalidating from inside the operation that caused it can
+     deadlock on the locks the kernel holds for it. Anything that
+     changes behind the kernel, such as a backup-file written by
+     another process, is seen once the timeout runs out */
+  env->cache_timeout = MYFS_CACHE_TIMEOUT;
+  if ((opts->cache != NULL) && (!__myfs_parse_size(&(env->cache_timeout), opts->cache))) {
+    fprintf(stderr, "Cannot parse cache timeout, using default\n");
+    env->cache_timeout = MYFS_CACHE_TIMEOUT;
+  }
+  env->ll_gen = NULL;
+  env->ll_refs = NULL;
+  env->ll_count = 0;
+
+  /* Every request pays for the lock, the lookup of its file and
+     the walk to its offset, so the kernel is asked to send reads
+     and writes as large as it can instead of a page at a time */
+  env->io_size = MYFS_IO_SIZE;
+  if ((opts->iosize != NULL) && (!__myfs_parse_size(&(env->io_size), opts->iosize))) {
+    fprintf(stderr, "Cannot parse request size, using default\n");
+    env->io_size = MYFS_IO_SIZE;
+  }
+  if (env->io_size < MYFS_IO_MIN) env->io_size = MYFS_IO_MIN;
+  if (env->io_size > MYFS_IO_SIZE) env->io_size = MYFS_IO_SIZE;
+  env->wbcache = opts->wbcache;
+#ifndef FUSE_CAP_WRITEBACK_CACHE
+  if (env->wbcache) {
+    fprintf(stderr, "This libfuse cannot ask for the kernel's write-back cache, not using it\n");
+    env->wbcache = 0;
+  }
+#endif
+
+  /* Size and place the pool of threads requests are processed by */
+  env->workers = MYFS_WORKERS;
+  if ((opts->workers != NULL) &&
+      ((!__myfs_parse_size(&(env->workers), opts->workers)) || (env->workers == 0))) {
+    fprintf(stderr, "Cannot parse number of workers, using default\n");
+    env->workers = MYFS_WORKERS;
+  }
+  env->cpus = NULL;
+  env->ncpus = 0;
+  if ((opts->cpus != NULL) && (!__myfs_parse_cpus(&(env->cpus), &(env->ncpus), opts->cpus))) {
+    fprintf(stderr, "Cannot parse CPU list, not pinning workers\n");
+  }
+  pthread_cond_init(&(env->bg_cond), NULL);
+  pthread_cond_init(&(env->reclaim_cond), NULL);
   
   /* Get uid and gid, write back and succeed */
   env->uid = getuid();
@@ -251,6 +581,15 @@ static void __myfs_clear_environment(struct __myfs_environment_struct_t *env) {
       perror("Cannot close backup-file");
     }
   }
+  if (env->stats_fd != STDERR_FILENO) {
+    if (close(env->stats_fd) != 0) {
+      perror("Cannot close stats log");
+    }
+  }
+  trace_close(env->trace);
+  free(env->cpus);
+  pthread_cond_destroy(&(env->bg_cond));
+  pthread_cond_destroy(&(env->reclaim_cond));
   if (pthread_mutex_destroy(&(env->env_lock)) != 0) {
     perror("Cannot destroy mutex");
   }
@@ -264,6 +603,17 @@ static int __myfs_sync_environment(struct __myfs_environment_struct_t *env) {
   return 0;
 }
 
+/* Records one call of a FUSE operation in the trace, if tracing.
+   The result is recorded the way the callback returns it, as
+   -errno on failure.
+*/
+static void __myfs_trace(struct __myfs_environment_struct_t *env, int op,
+                         const char *path, const char *path2, off_t offset, size_t size,
+                         uint64_t start, int res, int err) {
+  if (env->trace == NULL) return;
+  trace_log(env->trace, op, path, path2, offset, size, start, (res >= 0) ? res : -err);
+}
+
 /* Declaration for the implementations of the operations */
 
 int __myfs_getattr_implem(void *, size_t, int *, uid_t, gid_t, const char *, struct stat *);
@@ -279,22 +629,592 @@ int __myfs_read_implem(void *, size_t, int *, const char *, char *, size_t, off_
 int __myfs_write_implem(void *, size_t, int *, const char *, const char *, size_t, off_t);
 int __myfs_statfs_implem(void *, size_t, int *, struct statvfs*);
 int __myfs_utimens_implem(void *, size_t, int *, const char *, const struct timespec [2]);
+int __myfs_release_implem(void *, size_t, int *, const char *);
+int __myfs_fallocate_implem(void *, size_t, int *, const char *, int, off_t, off_t);
+int __myfs_defrag_implem(void *, size_t, int *, size_t *, size_t);
+int __myfs_reclaim_implem(void *, size_t, int *, size_t);
+int __myfs_recover_implem(void *, size_t, int *);
+int __myfs_lookup_implem(void *, size_t, int *, uint64_t, const char *, uint64_t *);
+int __myfs_getattr_node_implem(void *, size_t, int *, uid_t, gid_t, uint64_t, struct stat *);
+int __myfs_readdir_node_implem(void *, size_t, int *, uint64_t, char ***, uint64_t **);
+int __myfs_mknod_node_implem(void *, size_t, int *, uint64_t, const char *, uint64_t *);
+int __myfs_mkdir_node_implem(void *, size_t, int *, uint64_t, const char *, uint64_t *);
+int __myfs_unlink_node_implem(void *, size_t, int *, uint64_t, const char *, uint64_t *);
+int __myfs_rmdir_node_implem(void *, size_t, int *, uint64_t, const char *);
+int __myfs_rename_node_implem(void *, size_t, int *, uint64_t, const char *, uint64_t, const char *);
+int __myfs_truncate_node_implem(void *, size_t, int *, uint64_t, off_t);
+int __myfs_open_node_implem(void *, size_t, int *, uint64_t);
+int __myfs_read_node_implem(void *, size_t, int *, uint64_t, char *, size_t, off_t);
+int __myfs_write_node_implem(void *, size_t, int *, uint64_t, const char *, size_t, off_t);
+int __myfs_utimens_node_implem(void *, size_t, int *, uint64_t, const struct timespec [2]);
+int __myfs_release_node_implem(void *, size_t, int *, uint64_t);
+int __myfs_fallocate_node_implem(void *, size_t, int *, uint64_t, int, off_t, off_t);
+int __myfs_forget_implem(void *, size_t, int *, uint64_t);
+int __myfs_extents_implem(void *, size_t, int *, const char *, off_t, size_t, size_t *, size_t *, size_t);
+int __myfs_extents_node_implem(void *, size_t, int *, uint64_t, off_t, size_t, size_t *, size_t *, size_t);
 
 /* End of declarations */
 
+/* Virtual stats file part
+
+   The file /.myfs/stats is answered here, without going through
+   the implementation, and reads as a report of the operation
+   counters and latency histograms kept by myfs_stats.c. Every
+   open takes its own snapshot of the report, so a reader sees
+   one consistent text however it chunks its reads. The
+   directory /.myfs is not listed in the root directory, is
+   read-only, and shadows anything of the same name inside the
+   filesystem.
+
+   The same report is written to the stats log (standard error
+   unless --statslog is given) whenever the process receives
+   SIGUSR1.
+*/
+
+#define MYFS_STATS_DIR   "/.myfs"
+#define MYFS_STATS_FILE  "/.myfs/stats"
+
+#define MYFS_VIRTUAL_DIR   1
+#define MYFS_VIRTUAL_FILE  2
+#define MYFS_VIRTUAL_NONE  3
+
+struct __myfs_stats_snapshot_t {
+  size_t len;
+  char   text[];
+};
+
+static int __myfs_virtual_path(const char *path) {
+  if (strcmp(path, MYFS_STATS_DIR) == 0) return MYFS_VIRTUAL_DIR;
+  if (strcmp(path, MYFS_STATS_FILE) == 0) return MYFS_VIRTUAL_FILE;
+  if (strncmp(path, MYFS_STATS_DIR "/", sizeof(MYFS_STATS_DIR)) == 0) return MYFS_VIRTUAL_NONE;
+  return 0;
+}
+
+static int __myfs_virtual_getattr(struct __myfs_environment_struct_t *env, int kind, struct stat *st) {
+  if (kind == MYFS_VIRTUAL_NONE) return -ENOENT;
+  st->st_uid = env->uid;
+  st->st_gid = env->gid;
+  clock_gettime(CLOCK_REALTIME, &(st->st_mtim));
+  st->st_atim = st->st_mtim;
+  st->st_ctim = st->st_mtim;
+  if (kind == MYFS_VIRTUAL_DIR) {
+    st->st_mode = S_IFDIR | 0555;
+    st->st_nlink = 2;
+  } else {
+    st->st_mode = S_IFREG | 0444;
+    st->st_nlink = 1;
+    st->st_size = stat_report(NULL, 0);
+  }
+  return 0;
+}
+
+static int __myfs_virtual_open(struct fuse_file_info *fi) {
+  struct __myfs_stats_snapshot_t *snap;
+  size_t len, got;
+
+  if ((fi->flags & O_ACCMODE) != O_RDONLY) return -EACCES;
+  len = stat_report(NULL, 0);
+  snap = malloc(sizeof(struct __myfs_stats_snapshot_t) + len + 1);
+  if (snap == NULL) return -ENOMEM;
+  got = stat_report(snap->text, len + 1);
+  snap->len = (got < len) ? got : len;
+  fi->fh = (uint64_t) (uintptr_t) snap;
+  fi->direct_io = 1;
+  return 0;
+}
+
+static int __myfs_virtual_read(char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+  struct __myfs_stats_snapshot_t *snap;
+
+  snap = (struct __myfs_stats_snapshot_t *) (uintptr_t) fi->fh;
+  if (snap == NULL) return -EBADF;
+  if (offset < 0) return -EINVAL;
+  if (((size_t) offset) >= snap->len) return 0;
+  if (size > snap->len - offset) size = snap->len - offset;
+  memcpy(buf, snap->text + offset, size);
+  return size;
+}
+
+static void *__myfs_stats_thread(void *arg) {
+  struct __myfs_environment_struct_t *env;
+  sigset_t set;
+  int sig;
+
+  env = (struct __myfs_environment_struct_t *) arg;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  while (sigwait(&set, &sig) == 0) {
+    if (sig == SIGUSR1) stat_dump(env->stats_fd);
+  }
+  return NULL;
+}
+
+/* End of virtual stats file part */
+
+/* Write-back buffer part
+
+   Appending writes are not written to the image right away but
+   collected in a buffer per file, outside the image, and written
+   in one piece when the buffer is flushed: on fsync and release,
+   when the buffer is full or all buffers together hold more than
+   MYFS_WB_FILES full ones, before any other operation on the
+   file needs its contents, and by the write-back thread once the
+   oldest buffered data is MYFS_WB_AGE old. The allocator then
+   sees the whole extent at once and lays it out contiguously,
+   and a file removed before its buffer is flushed never takes
+   blocks at all.
+
+   Only writes at the end of a regular file are buffered, any
+   other write first flushes the file's buffer and goes to the
+   image directly. Buffers are keyed by path, or by node with a
+   NULL path under the low-level frontend, and only touched
+   with env_lock held. A write is only buffered while the
+   filesystem has room for it, so a full filesystem fails the
+   write itself; a flush failing anyway is reported by fsync and
+   release, a flush by the write-back thread is retried.
+*/
+
+#define MYFS_WB_DIRECT  (-2)
+#define MYFS_WB_SELF    1
+#define MYFS_WB_BELOW   2
+
+struct __myfs_wbuf_struct_t {
+  struct __myfs_wbuf_struct_t *next;
+  char            *path;
+  uint64_t        node;
+  off_t           off;
+  size_t          len;
+  size_t          cap;
+  uint64_t        since;
+  struct timespec mtime;
+  char            *data;
+};
+typedef struct __myfs_wbuf_struct_t myfs_wbuf_t;
+
+static myfs_wbuf_t **__myfs_wb_find(struct __myfs_environment_struct_t *env, const char *path) {
+  myfs_wbuf_t **link;
+
+  for (link = &(env->wb_list); *link != NULL; link = &((*link)->next)) {
+    if (((*link)->path != NULL) && (strcmp((*link)->path, path) == 0)) return link;
+  }
+  return NULL;
+}
+
+static myfs_wbuf_t **__myfs_wb_find_node(struct __myfs_environment_struct_t *env, uint64_t node) {
+  myfs_wbuf_t **link;
+
+  for (link = &(env->wb_list); *link != NULL; link = &((*link)->next)) {
+    if (((*link)->path == NULL) && ((*link)->node == node)) return link;
+  }
+  return NULL;
+}
+
+static void __myfs_wb_drop(struct __myfs_environment_struct_t *env, myfs_wbuf_t **link) {
+  myfs_wbuf_t *wb;
+
+  wb = *link;
+  *link = wb->next;
+  env->wb_total -= wb->len;
+  free(wb->path);
+  free(wb->data);
+  free(wb);
+}
+
+/* Writes the buffer at *link to the image and drops it. On failure
+   the buffer is dropped as well unless keep is set.
+*/
+static int __myfs_wb_flush(struct __myfs_environment_struct_t *env, myfs_wbuf_t **link,
+                           int *errnoptr, int keep) {
+  myfs_wbuf_t *wb;
+  struct timespec ts[2];
+  struct stat st;
+  int res, got, err;
+
+  wb = *link;
+  if (wb->path != NULL) {
+    res = __myfs_write_implem(env->memory, env->size, errnoptr, wb->path, wb->data, wb->len, wb->off);
+  } else {
+    res = __myfs_write_node_implem(env->memory, env->size, errnoptr, wb->node, wb->data, wb->len, wb->off);
+  }
+  /* The file keeps the time of its last buffered write, which is
+     what getattr reported and the kernel may still have cached */
+  if (res >= 0) {
+    if (wb->path != NULL) {
+      got = __myfs_getattr_implem(env->memory, env->size, &err, env->uid, env->gid, wb->path, &st);
+    } else {
+      got = __myfs_getattr_node_implem(env->memory, env->size, &err, env->uid, env->gid, wb->node, &st);
+    }
+    if (got == 0) {
+      ts[0] = st.st_atim;
+      ts[1] = wb->mtime;
+      if (wb->path != NULL) {
+        __myfs_utimens_implem(env->memory, env->size, &err, wb->path, ts);
+      } else {
+        __myfs_utimens_node_implem(env->memory, env->size, &err, wb->node, ts);
+      }
+    }
+  }
+  if ((res < 0) && keep) return -1;
+  __myfs_wb_drop(env, link);
+  return (res < 0) ? -1 : 0;
+}
+
+/* Flushes the buffer of path with MYFS_WB_SELF and those of the
+   files below path with MYFS_WB_BELOW, stops at the first failure.
+*/
+static int __myfs_wb_flush_path(struct __myfs_environment_struct_t *env, const char *path,
+                                int which, int *errnoptr) {
+  myfs_wbuf_t **link;
+  size_t len;
+
+  len = strlen(path);
+  for (link = &(env->wb_list); *link != NULL;) {
+    if (((*link)->path != NULL) &&
+        (((which & MYFS_WB_SELF) && (strcmp((*link)->path, path) == 0)) ||
+         ((which & MYFS_WB_BELOW) && (strncmp((*link)->path, path, len) == 0) && ((*link)->path[len] == '/')))) {
+      if (__myfs_wb_flush(env, link, errnoptr, 0) < 0) return -1;
+    } else {
+      link = &((*link)->next);
+    }
+  }
+  return 0;
+}
+
+static int __myfs_wb_flush_all(struct __myfs_environment_struct_t *env, int *errnoptr, int keep) {
+  myfs_wbuf_t **link;
+  int res;
+
+  res = 0;
+  for (link = &(env->wb_list); *link != NULL;) {
+    if (__myfs_wb_flush(env, link, errnoptr, keep) < 0) {
+      res = -1;
+      if (keep) link = &((*link)->next);
+    }
+  }
+  return res;
+}
+
+/* Buffers a write if it appends to a regular file, returns
+   MYFS_WB_DIRECT if the caller has to write it to the image
+   itself, after flushing what is buffered for the file. The
+   file is path, or node if path is NULL.
+*/
+static int __myfs_wb_write(struct __myfs_environment_struct_t *env, const char *path, uint64_t node,
+                           const char *buf, size_t size, off_t offset, int *errnoptr) {
+  myfs_wbuf_t **link, *wb;
+  struct statvfs stv;
+  struct stat st;
+  size_t cap;
+  char *data;
+  int err;
+
+  /* A buffer of another file that cannot be flushed stays buffered,
+     its error is its own, this write then goes to the image */
+  if ((env->wb_total + size > env->wb_max * MYFS_WB_FILES) &&
+      (__myfs_wb_flush_all(env, &err, 1) < 0) &&
+      (env->wb_total + size > env->wb_max * MYFS_WB_FILES)) {
+    link = (path != NULL) ? __myfs_wb_find(env, path) : __myfs_wb_find_node(env, node);
+    if ((link != NULL) && (__myfs_wb_flush(env, link, errnoptr, 0) < 0)) return -1;
+    return MYFS_WB_DIRECT;
+  }
+  link = (path != NULL) ? __myfs_wb_find(env, path) : __myfs_wb_find_node(env, node);
+  if ((env->wb_max == 0) || (size > env->wb_max)) {
+    if ((link != NULL) && (__myfs_wb_flush(env, link, errnoptr, 0) < 0)) return -1;
+    return MYFS_WB_DIRECT;
+  }
+  if ((link != NULL) && ((offset != (*link)->off + (off_t) (*link)->len) ||
+                         ((*link)->len + size > env->wb_max))) {
+    if (__myfs_wb_flush(env, link, errnoptr, 0) < 0) return -1;
+    link = NULL;
+  }
+  if (link == NULL) {
+    if (((path != NULL) &&
+         (__myfs_getattr_implem(env->memory, env->size, errnoptr, env->uid, env->gid, path, &st) < 0)) ||
+        ((path == NULL) &&
+         (__myfs_getattr_node_implem(env->memory, env->size, errnoptr, env->uid, env->gid, node, &st) < 0)))
+      return -1;
+    if ((!S_ISREG(st.st_mode)) || (offset != st.st_size)) return MYFS_WB_DIRECT;
+    wb = calloc(1, sizeof(myfs_wbuf_t));
+    if (wb == NULL) return MYFS_WB_DIRECT;
+    if ((path != NULL) && ((wb->path = strdup(path)) == NULL)) {
+      free(wb);
+      return MYFS_WB_DIRECT;
+    }
+    wb->node = node;
+    wb->off = offset;
+    wb->since = stat_now();
+    wb->next = env->wb_list;
+    env->wb_list = wb;
+    link = &(env->wb_list);
+  }
+  wb = *link;
+  /* What the filesystem could not take is not buffered, the
+     direct write then fails with the right error */
+  __myfs_statfs_implem(env->memory, env->size, errnoptr, &stv);
+  if ((wb->len + size) / stv.f_bsize + 2 > stv.f_bfree) {
+    if (__myfs_wb_flush(env, link, errnoptr, 0) < 0) return -1;
+    return MYFS_WB_DIRECT;
+  }
+  if (wb->len + size > wb->cap) {
+    cap = (wb->cap == 0) ? size : wb->cap;
+    while (cap < wb->len + size) cap *= 2;
+    if (cap > env->wb_max) cap = env->wb_max;
+    if ((data = realloc(wb->data, cap)) == NULL) {
+      if (__myfs_wb_flush(env, link, errnoptr, 0) < 0) return -1;
+      return MYFS_WB_DIRECT;
+    }
+    wb->data = data;
+    wb->cap = cap;
+  }
+  memcpy(wb->data + wb->len, buf, size);
+  wb->len += size;
+  env->wb_total += size;
+  clock_gettime(CLOCK_REALTIME, &(wb->mtime));
+  return (int) size;
+}
+
+static void *__myfs_wb_thread(void *arg) {
+  struct __myfs_environment_struct_t *env;
+  myfs_wbuf_t **link;
+  struct timespec ts;
+  int err;
+
+  env = (struct __myfs_environment_struct_t *) arg;
+  pthread_mutex_lock(&(env->env_lock));
+  while (!(env->bg_stop)) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec++;
+    pthread_cond_timedwait(&(env->bg_cond), &(env->env_lock), &ts);
+    for (link = &(env->wb_list); *link != NULL;) {
+      if ((stat_now() - (*link)->since >= MYFS_WB_AGE) && (__myfs_wb_flush(env, link, &err, 1) == 0))
+        continue;
+      link = &((*link)->next);
+    }
+  }
+  pthread_mutex_unlock(&(env->env_lock));
+  return NULL;
+}
+
+/* End of write-back buffer part */
+
+/* Readahead part
+
+   With a backup file the image is a shared mapping of it, and a cold
+   read faults the pages it copies in one at a time, all with
+   env_lock held. Each file opened for reading gets a handle that
+   watches the offsets read through it: once two reads in a row are
+   the same distance apart, the data blocks the next reads will copy
+   are advised MADV_WILLNEED, so the kernel reads them in ahead and in
+   large pieces. A sequential reader is kept a window ahead that
+   doubles up to MYFS_RA_MAX, refilled once half of it is read, a
+   strided one the MYFS_RA_STRIDES records after the one just read.
+   The blocks are looked up with env_lock held and advised after it
+   is dropped.
+*/
+
+#define MYFS_RA_MIN      ((size_t) (256 << 10))   /* 256kB */
+#define MYFS_RA_MAX      ((size_t) (8 << 20))     /* 8MB */
+#define MYFS_RA_STRIDES  4
+#define MYFS_RA_RUNS     64
+
+struct __myfs_handle_struct_t {
+  off_t  last;
+  off_t  stride;
+  off_t  ahead;
+  size_t window;
+  int    hits;
+};
+typedef struct __myfs_handle_struct_t myfs_handle_t;
+
+/* The handle for a file opened with flags, 0 for none when the file
+   is not read or there is no backup file to read ahead from */
+static uint64_t __myfs_ra_open(struct __myfs_environment_struct_t *env, int flags) {
+  if ((!env->using_backup) || ((flags & O_ACCMODE) == O_WRONLY)) return 0;
+  return (uint64_t) (uintptr_t) calloc(1, sizeof(myfs_handle_t));
+}
+
+/* Feeds the read of size bytes at offset to the handle h, and puts
+   the parts of the file to advise next into from and len, returns
+   their number */
+static int __myfs_ra_plan(myfs_handle_t *h, off_t offset, size_t size,
+                          off_t from[MYFS_RA_STRIDES], size_t len[MYFS_RA_STRIDES]) {
+  off_t stride, end;
+  int k, n;
+
+  stride = offset - h->last;
+  end = offset + (off_t) size;
+  h->last = offset;
+  if ((stride == 0) || (stride != h->stride)) {
+    h->stride = stride;
+    h->hits = 0;
+    h->window = 0;
+    h->ahead = end;
+    return 0;
+  }
+  h->hits++;
+  if (stride == (off_t) size) {
+    if ((h->window > 0) && (h->ahead - end >= (off_t) (h->window / 2))) return 0;
+    h->window = (h->window == 0) ? MYFS_RA_MIN : ((h->window * 2 > MYFS_RA_MAX) ? MYFS_RA_MAX : h->window * 2);
+    if (h->ahead < end) h->ahead = end;
+    from[0] = h->ahead;
+    len[0] = (size_t) (end + (off_t) h->window - h->ahead);
+    h->ahead = end + (off_t) h->window;
+    return 1;
+  }
+  n = 0;
+  for (k = (h->hits == 1) ? 1 : MYFS_RA_STRIDES; k <= MYFS_RA_STRIDES; k++) {
+    if (offset + k * stride < 0) break;
+    from[n] = offset + k * stride;
+    len[n++] = size;
+  }
+  return n;
+}
+
+/* Plans readahead for a read through the handle fh of the file at
+   path, or of node when path is NULL, and puts where its data lies
+   in the image into starts and lens, returns the number of ranges,
+   env_lock is held */
+static int __myfs_ra_find(struct __myfs_environment_struct_t *env, uint64_t fh, const char *path, uint64_t node,
+                          off_t offset, size_t size, size_t starts[MYFS_RA_RUNS], size_t lens[MYFS_RA_RUNS]) {
+  off_t from[MYFS_RA_STRIDES];
+  size_t len[MYFS_RA_STRIDES];
+  int n, k, got, runs, err;
+
+  if (fh == 0) return 0;
+  n = __myfs_ra_plan((myfs_handle_t *) (uintptr_t) fh, offset, size, from, len);
+  runs = 0;
+  for (k = 0; (k < n) && (runs < MYFS_RA_RUNS); k++) {
+    if (path != NULL) {
+      got = __myfs_extents_implem(env->memory, env->size, &err, path, from[k], len[k],
+                                  starts + runs, lens + runs, MYFS_RA_RUNS - runs);
+    } else {
+      got = __myfs_extents_node_implem(env->memory, env->size, &err, node, from[k], len[k],
+                                       starts + runs, lens + runs, MYFS_RA_RUNS - runs);
+    }
+    if (got > 0) runs += got;
+  }
+  return runs;
+}
+
+static void __myfs_ra_advise(struct __myfs_environment_struct_t *env, size_t starts[MYFS_RA_RUNS],
+                             size_t lens[MYFS_RA_RUNS], int runs) {
+  size_t page, start;
+  int k;
+
+  page = (size_t) sysconf(_SC_PAGESIZE);
+  for (k = 0; k < runs; k++) {
+    start = starts[k] - (starts[k] % page);
+    madvise(((char *) env->memory) + start, lens[k] + (starts[k] - start), MADV_WILLNEED);
+  }
+}
+
+/* End of readahead part */
+
+/* Defragmentation part */
+
+/* Moves the blocks of fragmented files a tick's share of the rate at a
+   time, so the lock is never held for long and foreground operations
+   interleave with it. A pass that moves nothing means every file is
+   contiguous or cannot be placed better, then the thread waits longer
+   before looking again.
+*/
+static void *__myfs_defrag_thread(void *arg) {
+  struct __myfs_environment_struct_t *env;
+  struct timespec ts;
+  size_t batch;
+  int moved, err;
+
+  env = (struct __myfs_environment_struct_t *) arg;
+  batch = env->defrag_rate / (1000000000 / MYFS_DEFRAG_TICK);
+  if (batch == 0) batch = 1;
+  moved = 1;
+  pthread_mutex_lock(&(env->env_lock));
+  while (!(env->bg_stop)) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (moved > 0) {
+      ts.tv_nsec += MYFS_DEFRAG_TICK;
+      if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+    } else {
+      ts.tv_sec += MYFS_DEFRAG_IDLE;
+    }
+    pthread_cond_timedwait(&(env->bg_cond), &(env->env_lock), &ts);
+    if (env->bg_stop) break;
+    moved = __myfs_defrag_implem(env->memory, env->size, &err, &(env->defrag_cursor), batch);
+  }
+  pthread_mutex_unlock(&(env->env_lock));
+  return NULL;
+}
+
+/* End of defragmentation part */
+
+/* Orphan reclamation part */
+
+/* Frees the blocks of unlinked and truncated files a batch at a time,
+   letting go of the lock between batches so a large delete does not
+   hold up other operations. The orphan list lives in the image, so
+   whatever is left at unmount is freed after the next mount.
+*/
+static void *__myfs_reclaim_thread(void *arg) {
+  struct __myfs_environment_struct_t *env;
+  int err;
+
+  env = (struct __myfs_environment_struct_t *) arg;
+  pthread_mutex_lock(&(env->env_lock));
+  while (!(env->bg_stop)) {
+    if (__myfs_reclaim_implem(env->memory, env->size, &err, MYFS_RECLAIM_BATCH) > 0) {
+      pthread_mutex_unlock(&(env->env_lock));
+      sched_yield();
+      pthread_mutex_lock(&(env->env_lock));
+    } else {
+      pthread_cond_wait(&(env->reclaim_cond), &(env->env_lock));
+    }
+  }
+  pthread_mutex_unlock(&(env->env_lock));
+  return NULL;
+}
+
+/* Called with the lock held after an operation that may have orphaned
+   blocks. Without the thread they are freed right away. */
+static void __myfs_reclaim_kick(struct __myfs_environment_struct_t *env) {
+  int err;
+
+  if (env->reclaim_running) {
+    pthread_cond_signal(&(env->reclaim_cond));
+  } else {
+    while (__myfs_reclaim_implem(env->memory, env->size, &err, MYFS_RECLAIM_BATCH) > 0);
+  }
+}
+
+/* End of orphan reclamation part */
+
 /* FUSE operations part */
 
 static int __myfs_getattr(const char *path, struct stat *st) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
-  int __myfs_errno, res;
+  int __myfs_errno, res, kind;
+  uint64_t stat_start;
+  myfs_wbuf_t **link;
 
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
 
   memset(st, 0, sizeof(struct stat));
+  /* The attribute timeout here is the same for every file, and the
+     stats file changes with every read, so it shows no size and is
+     read to its end through direct_io, as the low-level frontend
+     does with a timeout of its own */
+  if ((kind = __myfs_virtual_path(path)) != 0) {
+    res = __myfs_virtual_getattr(env, kind, st);
+    if (kind == MYFS_VIRTUAL_FILE) st->st_size = 0;
+    return res;
+  }
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_getattr_implem(env->memory,
                               env->size,
@@ -303,7 +1223,14 @@ static int __myfs_getattr(const char *path, struct stat *st) {
                               env->gid,
                               path,
                               st);
+  if ((res >= 0) && ((link = __myfs_wb_find(env, path)) != NULL)) {
+    if (st->st_size < (*link)->off + (off_t) (*link)->len)
+      st->st_size = (*link)->off + (off_t) (*link)->len;
+    st->st_mtim = (*link)->mtime;
+  }
   pthread_mutex_unlock(&(env->env_lock));  
+  stat_end(ST_GETATTR, stat_start, res < 0);
+  __myfs_trace(env, ST_GETATTR, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -313,7 +1240,8 @@ static int __myfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                           off_t offset, struct fuse_file_info *fi) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
-  int __myfs_errno, res, i;
+  int __myfs_errno, res, i, kind;
+  uint64_t stat_start;
   char **names;
   
   (void) offset;
@@ -322,8 +1250,18 @@ static int __myfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
 
+  if ((kind = __myfs_virtual_path(path)) != 0) {
+    if (kind != MYFS_VIRTUAL_DIR)
+      return (kind == MYFS_VIRTUAL_FILE) ? -ENOTDIR : -ENOENT;
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    filler(buf, MYFS_STATS_FILE + sizeof(MYFS_STATS_DIR), NULL, 0);
+    return 0;
+  }
+
   names = NULL;
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_readdir_implem(env->memory,
                               env->size,
@@ -331,6 +1269,8 @@ static int __myfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                               path,
                               &names);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_READDIR, stat_start, res < 0);
+  __myfs_trace(env, ST_READDIR, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0) {
     if (res == 0) {
       filler(buf, ".", NULL, 0);
@@ -358,6 +1298,7 @@ static int __myfs_mknod(const char* path, mode_t mode, dev_t dev) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
 
   (void) dev;
 
@@ -365,14 +1306,19 @@ static int __myfs_mknod(const char* path, mode_t mode, dev_t dev) {
   
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_mknod_implem(env->memory,
                             env->size,
                             &__myfs_errno,
                             path);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_MKNOD, stat_start, res < 0);
+  __myfs_trace(env, ST_MKNOD, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -382,17 +1328,27 @@ static int __myfs_unlink(const char* path) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
+  myfs_wbuf_t **link;
   
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_unlink_implem(env->memory,
                              env->size,
                              &__myfs_errno,
                              path);
+  if ((res >= 0) && ((link = __myfs_wb_find(env, path)) != NULL))
+    __myfs_wb_drop(env, link);
+  if (res >= 0) __myfs_reclaim_kick(env);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_UNLINK, stat_start, res < 0);
+  __myfs_trace(env, ST_UNLINK, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -402,17 +1358,25 @@ static int __myfs_mkdir(const char* path, mode_t mode) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
+
+  (void) mode;
   
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_mkdir_implem(env->memory,
                             env->size,
                             &__myfs_errno,
                             path);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_MKDIR, stat_start, res < 0);
+  __myfs_trace(env, ST_MKDIR, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -422,17 +1386,23 @@ static int __myfs_rmdir(const char* path) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
 
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_rmdir_implem(env->memory,
                             env->size,
                             &__myfs_errno,
                             path);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_RMDIR, stat_start, res < 0);
+  __myfs_trace(env, ST_RMDIR, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -442,18 +1412,38 @@ static int __myfs_rename(const char* from, const char* to) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
+  myfs_wbuf_t **link;
+  char *path;
 
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(from) || __myfs_virtual_path(to)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
-  res = __myfs_rename_implem(env->memory,
-                             env->size,
-                             &__myfs_errno,
-                             from,
-                             to);
+  /* A buffered file keeps its buffer under the new name, files
+     below a renamed directory and a replaced target are flushed */
+  res = __myfs_wb_flush_path(env, to, MYFS_WB_SELF | MYFS_WB_BELOW, &__myfs_errno);
+  if (res >= 0) res = __myfs_wb_flush_path(env, from, MYFS_WB_BELOW, &__myfs_errno);
+  if (res >= 0) res = __myfs_rename_implem(env->memory,
+                                           env->size,
+                                           &__myfs_errno,
+                                           from,
+                                           to);
+  if ((res >= 0) && ((link = __myfs_wb_find(env, from)) != NULL)) {
+    if ((path = strdup(to)) != NULL) {
+      free((*link)->path);
+      (*link)->path = path;
+    } else if (__myfs_wb_flush(env, link, &__myfs_errno, 0) < 0) {
+      res = -1;
+    }
+  }
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_RENAME, stat_start, res < 0);
+  __myfs_trace(env, ST_RENAME, from, to, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -463,18 +1453,31 @@ static int __myfs_truncate(const char* path, off_t size) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
+  myfs_wbuf_t **link;
 
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
-  res = __myfs_truncate_implem(env->memory,
+  res = 0;
+  if ((link = __myfs_wb_find(env, path)) != NULL) {
+    if (size <= (*link)->off) __myfs_wb_drop(env, link);
+    else res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+  }
+  if (res >= 0) res = __myfs_truncate_implem(env->memory,
                                env->size,
                                &__myfs_errno,
                                path,
                                size);
+  if (res >= 0) __myfs_reclaim_kick(env);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_TRUNCATE, stat_start, res < 0);
+  __myfs_trace(env, ST_TRUNCATE, path, NULL, size, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -483,7 +1486,8 @@ static int __myfs_truncate(const char* path, off_t size) {
 static int __myfs_open(const char* path, struct fuse_file_info* fi) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
-  int __myfs_errno, res;
+  int __myfs_errno, res, kind;
+  uint64_t stat_start;
 
   if (!(((fi->flags & O_ACCMODE) == O_RDONLY) ||
         ((fi->flags & O_ACCMODE) == O_WRONLY) ||
@@ -492,16 +1496,26 @@ static int __myfs_open(const char* path, struct fuse_file_info* fi) {
   
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if ((kind = __myfs_virtual_path(path)) != 0) {
+    if (kind == MYFS_VIRTUAL_FILE) return __myfs_virtual_open(fi);
+    return (kind == MYFS_VIRTUAL_DIR) ? -EISDIR : -ENOENT;
+  }
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_open_implem(env->memory,
                            env->size,
                            &__myfs_errno,
                            path);
   pthread_mutex_unlock(&(env->env_lock));
-  if (res >= 0)
+  stat_end(ST_OPEN, stat_start, res < 0);
+  __myfs_trace(env, ST_OPEN, path, NULL, 0, 0, stat_start, res, __myfs_errno);
+  if (res >= 0) {
+    fi->fh = __myfs_ra_open(env, fi->flags);
     return res;
+  }
   return -__myfs_errno;
 }
 
@@ -509,22 +1523,35 @@ static int __myfs_read(const char* path, char *buf, size_t size, off_t offset, s
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
+  myfs_wbuf_t **link;
+  size_t ra_starts[MYFS_RA_RUNS], ra_lens[MYFS_RA_RUNS];
+  int ra_runs;
 
-  (void) fi;
-  
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path) == MYFS_VIRTUAL_FILE)
+    return __myfs_virtual_read(buf, size, offset, fi);
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
-  res = __myfs_read_implem(env->memory,
+  res = 0;
+  if (((link = __myfs_wb_find(env, path)) != NULL) && (offset + (off_t) size > (*link)->off))
+    res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+  if (res >= 0) res = __myfs_read_implem(env->memory,
                            env->size,
                            &__myfs_errno,
                            path,
                            buf,
                            size,
                            offset);
+  ra_runs = (res > 0) ? __myfs_ra_find(env, fi->fh, path, 0, offset, size, ra_starts, ra_lens) : 0;
   pthread_mutex_unlock(&(env->env_lock));
+  __myfs_ra_advise(env, ra_starts, ra_lens, ra_runs);
+  stat_end(ST_READ, stat_start, res < 0);
+  __myfs_trace(env, ST_READ, path, NULL, offset, size, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -534,15 +1561,20 @@ static int __myfs_write(const char* path, const char *buf, size_t size, off_t of
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
 
   (void) fi;
   
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
-  res = __myfs_write_implem(env->memory,
+  res = __myfs_wb_write(env, path, 0, buf, size, offset, &__myfs_errno);
+  if (res == MYFS_WB_DIRECT) res = __myfs_write_implem(env->memory,
                             env->size,
                             &__myfs_errno,
                             path,
@@ -550,6 +1582,8 @@ static int __myfs_write(const char* path, const char *buf, size_t size, off_t of
                             size,
                             offset);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_WRITE, stat_start, res < 0);
+  __myfs_trace(env, ST_WRITE, path, NULL, offset, size, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -559,6 +1593,7 @@ static int __myfs_statfs(const char* path, struct statvfs* stbuf) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
 
   (void) path;
   
@@ -568,12 +1603,15 @@ static int __myfs_statfs(const char* path, struct statvfs* stbuf) {
   memset(stbuf, 0, sizeof(struct statvfs));
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
   res = __myfs_statfs_implem(env->memory,
                              env->size,
                              &__myfs_errno,
                              stbuf);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_STATFS, stat_start, res < 0);
+  __myfs_trace(env, ST_STATFS, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -583,18 +1621,26 @@ static int __myfs_utimens(const char* path, const struct timespec ts[2]) {
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
 
   context = fuse_get_context();
   env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
   
   __myfs_errno = ENOENT;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
-  res = __myfs_utimens_implem(env->memory,
+  /* Buffered data would otherwise stamp the file again when flushed */
+  res = __myfs_wb_flush_path(env, path, MYFS_WB_SELF, &__myfs_errno);
+  if (res >= 0) res = __myfs_utimens_implem(env->memory,
                               env->size,
                               &__myfs_errno,
                               path,
                               ts);
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_UTIMENS, stat_start, res < 0);
+  __myfs_trace(env, ST_UTIMENS, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;
@@ -604,6 +1650,7 @@ static int __myfs_fsync(const char *path, int datasync, struct fuse_file_info *f
   struct fuse_context *context;
   struct __myfs_environment_struct_t *env;
   int __myfs_errno, res;
+  uint64_t stat_start;
   
   (void) path;
   (void) datasync;
@@ -613,42 +1660,1363 @@ static int __myfs_fsync(const char *path, int datasync, struct fuse_file_info *f
   env = (struct __myfs_environment_struct_t *) (context->private_data);
   
   __myfs_errno = EIO;
+  stat_start = stat_now();
   pthread_mutex_lock(&(env->env_lock));
-  res = __myfs_sync_environment(env);
+  res = __myfs_wb_flush_path(env, path, MYFS_WB_SELF, &__myfs_errno);
+  if (res >= 0) {
+    __myfs_release_implem(env->memory, env->size, &__myfs_errno, path);
+    __myfs_errno = EIO;
+    res = __myfs_sync_environment(env);
+  }
   pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_FSYNC, stat_start, res < 0);
+  __myfs_trace(env, ST_FSYNC, path, NULL, 0, 0, stat_start, res, __myfs_errno);
   if (res >= 0)
     return res;
   return -__myfs_errno;  
 }
 
-static void __myfs_destroy(void *private_data) {
+static int __myfs_release(const char *path, struct fuse_file_info *fi) {
   struct __myfs_environment_struct_t *env;
-  
-  if (private_data == NULL) return;
-  env = (struct __myfs_environment_struct_t *) private_data;
-  __myfs_clear_environment(env);
+  int __myfs_errno, res;
+  uint64_t stat_start;
+
+  env = (struct __myfs_environment_struct_t *) (fuse_get_context()->private_data);
+
+  stat_start = stat_now();
+  if (__myfs_virtual_path(path) == MYFS_VIRTUAL_FILE) {
+    free((void *) (uintptr_t) fi->fh);
+    fi->fh = 0;
+    stat_end(ST_RELEASE, stat_start, 0);
+    return 0;
+  }
+  free((void *) (uintptr_t) fi->fh);
+  fi->fh = 0;
+  __myfs_errno = 0;
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_wb_flush_path(env, path, MYFS_WB_SELF, &__myfs_errno);
+  __myfs_release_implem(env->memory, env->size, &__myfs_errno, path);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_RELEASE, stat_start, res < 0);
+  __myfs_trace(env, ST_RELEASE, path, NULL, 0, 0, stat_start, res, __myfs_errno);
+  if (res >= 0)
+    return 0;
+  return -__myfs_errno;
 }
 
-static struct fuse_operations __myfs_operations = {
-  .getattr = __myfs_getattr,
-  .readdir = __myfs_readdir,
-  .mkdir = __myfs_mkdir,
-  .mknod = __myfs_mknod,
-  .unlink = __myfs_unlink,
-  .rmdir = __myfs_rmdir,
-  .rename = __myfs_rename,
-  .truncate = __myfs_truncate,
-  .open = __myfs_open,
-  .read = __myfs_read,
-  .write = __myfs_write,
-  .statfs = __myfs_statfs,
-  .utimens = __myfs_utimens,
-  .fsync = __myfs_fsync,
-  .destroy = __myfs_destroy
-};
+static int __myfs_fallocate(const char *path, int mode, off_t offset, off_t length,
+                            struct fuse_file_info *fi) {
+  struct fuse_context *context;
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start;
+
+  (void) fi;
+
+  context = fuse_get_context();
+  env = (struct __myfs_environment_struct_t *) (context->private_data);
+
+  if (__myfs_virtual_path(path)) return -EACCES;
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_wb_flush_path(env, path, MYFS_WB_SELF, &__myfs_errno);
+  if (res >= 0) res = __myfs_fallocate_implem(env->memory,
+                                env->size,
+                                &__myfs_errno,
+                                path,
+                                mode,
+                                offset,
+                                length);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_FALLOCATE, stat_start, res < 0);
+  __myfs_trace(env, ST_FALLOCATE | (mode << TRACE_OPBITS), path, NULL, offset, length, stat_start, res,
+               __myfs_errno);
+  if (res >= 0)
+    return res;
+  return -__myfs_errno;
+}
+
+/* Starts the background threads, called by either frontend once
+   FUSE runs */
+static void __myfs_start(struct __myfs_environment_struct_t *env) {
+  pthread_t thread;
+  int err;
+
+  if (env != NULL) {
+    if (pthread_create(&thread, NULL, __myfs_stats_thread, env) == 0) {
+      pthread_detach(thread);
+    } else {
+      perror("Cannot start stats thread");
+    }
+    if (pthread_create(&(env->wb_thread), NULL, __myfs_wb_thread, env) == 0) {
+      env->wb_running = 1;
+    } else {
+      perror("Cannot start write-back thread, not buffering writes");
+      env->wb_max = 0;
+    }
+    if (env->defrag_rate > 0) {
+      if (pthread_create(&(env->defrag_thread), NULL, __myfs_defrag_thread, env) == 0) {
+        env->defrag_running = 1;
+      } else {
+        perror("Cannot start defragmentation thread, not defragmenting");
+      }
+    }
+    /* Orphans left by the last mount are picked up by the reclaimer
+       as soon as it starts, or freed here if it cannot */
+    pthread_mutex_lock(&(env->env_lock));
+    __myfs_recover_implem(env->memory, env->size, &err);
+    if (pthread_create(&(env->reclaim_thread), NULL, __myfs_reclaim_thread, env) == 0) {
+      env->reclaim_running = 1;
+    } else {
+      perror("Cannot start reclaim thread, freeing blocks synchronously");
+      __myfs_reclaim_kick(env);
+    }
+    pthread_mutex_unlock(&(env->env_lock));
+  }
+}
+
+/* Stops the background threads, writes back what is buffered and
+   releases the environment */
+static void __myfs_stop(struct __myfs_environment_struct_t *env) {
+  int err;
+  
+  pthread_mutex_lock(&(env->env_lock));
+  env->bg_stop = 1;
+  pthread_cond_broadcast(&(env->bg_cond));
+  pthread_cond_signal(&(env->reclaim_cond));
+  if (__myfs_wb_flush_all(env, &err, 0) < 0)
+    fprintf(stderr, "Cannot write back buffered data: %s\n", strerror(err));
+  pthread_mutex_unlock(&(env->env_lock));
+  if (env->wb_running) pthread_join(env->wb_thread, NULL);
+  if (env->defrag_running) pthread_join(env->defrag_thread, NULL);
+  if (env->reclaim_running) pthread_join(env->reclaim_thread, NULL);
+  __myfs_clear_environment(env);
+}
+
+/* Asks the kernel for what the options want of the connection.
+
+   With --wbcache the kernel keeps written data in its page cache
+   and sends it in pages or larger, many small writes in one. It then
+   owns the size and mtime of files it holds dirty pages of, sets the
+   mtime with a setattr of its own, resolves O_APPEND itself, may
+   read pages of a file open for writing only and may write them
+   after release. None of this needs more of the frontends: reads do
+   not check the open mode, writes name their file by path or node
+   and not by handle, getattr includes buffered data and utimens
+   flushes it first so the kernel's mtime is the one kept.
+*/
+static void __myfs_conn_setup(struct __myfs_environment_struct_t *env, struct fuse_conn_info *conn) {
+#ifdef FUSE_CAP_WRITEBACK_CACHE
+  if (env->wbcache) {
+    if (conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+      conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+    } else {
+      fprintf(stderr, "The kernel has no write-back cache, not using it\n");
+    }
+  }
+#else
+  (void) env;
+  (void) conn;
+#endif
+}
+
+static void *__myfs_init(struct fuse_conn_info *conn) {
+  struct __myfs_environment_struct_t *env;
+
+  env = (struct __myfs_environment_struct_t *) (fuse_get_context()->private_data);
+  __myfs_conn_setup(env, conn);
+  __myfs_start(env);
+  return env;
+}
+
+static void __myfs_destroy(void *private_data) {
+  if (private_data == NULL) return;
+  __myfs_stop((struct __myfs_environment_struct_t *) private_data);
+}
+
+static struct fuse_operations __myfs_operations = {
+  .getattr = __myfs_getattr,
+  .readdir = __myfs_readdir,
+  .mkdir = __myfs_mkdir,
+  .mknod = __myfs_mknod,
+  .unlink = __myfs_unlink,
+  .rmdir = __myfs_rmdir,
+  .rename = __myfs_rename,
+  .truncate = __myfs_truncate,
+  .open = __myfs_open,
+  .read = __myfs_read,
+  .write = __myfs_write,
+  .statfs = __myfs_statfs,
+  .utimens = __myfs_utimens,
+  .fsync = __myfs_fsync,
+  .release = __myfs_release,
+  .fallocate = __myfs_fallocate,
+  .init = __myfs_init,
+  .destroy = __myfs_destroy
+};
 
 /* End of FUSE operations part */
 
+/* Session loop part
+
+   Both frontends are served by the loop below instead of libfuse's
+   own: the mounting thread reads requests from the kernel and queues
+   them, and a pool of --workers threads takes them off the queues
+   and processes them. Requests are sorted by opcode into two
+   classes, each with its own queue: data (read, write, setattr,
+   fsync, fallocate, flush, release), which can take long, and
+   metadata, everything else. A worker takes metadata first, and with
+   two or more workers at most all but one work on data at a time,
+   so a stat never waits behind a queue of large reads or truncates
+   for a worker to pick it up, only for env_lock.
+
+   With --cpus the workers are pinned to the listed CPUs, worker i to
+   the i-th CPU of the list, starting over at its end. With -s there
+   is a single worker, as libfuse would run a single thread.
+
+   How deep each queue gets, how long requests wait in it, and how
+   busy each worker is are added to the stats report, to size the
+   pool with.
+*/
+
+#define MYFS_Q_META   0
+#define MYFS_Q_DATA   1
+#define MYFS_Q_COUNT  2
+
+/* Opcodes of the kernel protocol (linux/fuse.h) sorted into the
+   data class, read from the header every request starts with: a
+   32-bit length, then the 32-bit opcode */
+#define MYFS_OP_SETATTR    4
+#define MYFS_OP_READ       15
+#define MYFS_OP_WRITE      16
+#define MYFS_OP_RELEASE    18
+#define MYFS_OP_FSYNC      20
+#define MYFS_OP_FLUSH      25
+#define MYFS_OP_FALLOCATE  43
+
+struct __myfs_sreq_struct_t {
+  struct __myfs_sreq_struct_t *next;
+  struct fuse_chan            *ch;
+  size_t                      len;
+  uint64_t                    queued;
+  char                        buf[];
+};
+typedef struct __myfs_sreq_struct_t myfs_sreq_t;
+
+struct __myfs_worker_struct_t {
+  struct __myfs_pool_struct_t *pool;
+  pthread_t                   thread;
+  int                         cpu;
+  uint64_t                    busy;
+  uint64_t                    requests;
+};
+
+struct __myfs_pool_struct_t {
+  struct fuse_session           *se;
+  pthread_mutex_t               lock;
+  pthread_cond_t                work;
+  myfs_sreq_t                   *head[MYFS_Q_COUNT];
+  myfs_sreq_t                   *tail[MYFS_Q_COUNT];
+  myfs_sreq_t                   *free;
+  size_t                        depth[MYFS_Q_COUNT];
+  size_t                        maxdepth[MYFS_Q_COUNT];
+  uint64_t                      depthsum[MYFS_Q_COUNT];
+  uint64_t                      queued[MYFS_Q_COUNT];
+  uint64_t                      waited[MYFS_Q_COUNT];
+  size_t                        data_busy;
+  size_t                        count;
+  int                           stop;
+  uint64_t                      start;
+  struct __myfs_worker_struct_t *workers;
+};
+
+static int __myfs_pool_class(const char *buf, size_t len) {
+  uint32_t opcode;
+
+  if (len < 2 * sizeof(uint32_t)) return MYFS_Q_META;
+  memcpy(&opcode, buf + sizeof(uint32_t), sizeof(uint32_t));
+  switch (opcode) {
+  case MYFS_OP_SETATTR:
+  case MYFS_OP_READ:
+  case MYFS_OP_WRITE:
+  case MYFS_OP_RELEASE:
+  case MYFS_OP_FSYNC:
+  case MYFS_OP_FLUSH:
+  case MYFS_OP_FALLOCATE:
+    return MYFS_Q_DATA;
+  default:
+    return MYFS_Q_META;
+  }
+}
+
+/* The queue the next request is taken from, -1 for none, the pool
+   lock is held */
+static int __myfs_pool_pick(struct __myfs_pool_struct_t *pool) {
+  if (pool->head[MYFS_Q_META] != NULL) return MYFS_Q_META;
+  if ((pool->head[MYFS_Q_DATA] != NULL) &&
+      ((pool->count == 1) || (pool->data_busy < pool->count - 1))) return MYFS_Q_DATA;
+  return -1;
+}
+
+/* Pins the calling thread to cpu, with the system call itself as
+   glibc declares its wrappers only for _GNU_SOURCE, under which
+   statvfs.h defines an ST_WRITE of its own */
+static void __myfs_pool_pin(int cpu) {
+  unsigned long int mask[MYFS_CPU_MAX / (8 * sizeof(unsigned long int))];
+
+  memset(mask, 0, sizeof(mask));
+  mask[cpu / (8 * sizeof(unsigned long int))] |= 1UL << (cpu % (8 * sizeof(unsigned long int)));
+  if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0)
+    fprintf(stderr, "Cannot pin a worker to CPU %d\n", cpu);
+}
+
+static void *__myfs_pool_worker(void *arg) {
+  struct __myfs_worker_struct_t *w;
+  struct __myfs_pool_struct_t *pool;
+  myfs_sreq_t *req;
+  uint64_t start;
+  int q;
+
+  w = (struct __myfs_worker_struct_t *) arg;
+  pool = w->pool;
+  if (w->cpu >= 0) __myfs_pool_pin(w->cpu);
+  pthread_mutex_lock(&(pool->lock));
+  for (;;) {
+    if ((q = __myfs_pool_pick(pool)) < 0) {
+      if (pool->stop && (pool->head[MYFS_Q_META] == NULL) && (pool->head[MYFS_Q_DATA] == NULL)) break;
+      pthread_cond_wait(&(pool->work), &(pool->lock));
+      continue;
+    }
+    req = pool->head[q];
+    if ((pool->head[q] = req->next) == NULL) pool->tail[q] = NULL;
+    pool->depth[q]--;
+    start = stat_now();
+    pool->waited[q] += start - req->queued;
+    if (q == MYFS_Q_DATA) pool->data_busy++;
+    pthread_mutex_unlock(&(pool->lock));
+
+    fuse_session_process(pool->se, req->buf, req->len, req->ch);
+
+    pthread_mutex_lock(&(pool->lock));
+    /* A data request may have been held back for this one */
+    if ((q == MYFS_Q_DATA) && ((pool->data_busy--) == pool->count - 1) && (pool->head[MYFS_Q_DATA] != NULL))
+      pthread_cond_signal(&(pool->work));
+    w->busy += stat_now() - start;
+    w->requests++;
+    req->next = pool->free;
+    pool->free = req;
+  }
+  pthread_mutex_unlock(&(pool->lock));
+  return NULL;
+}
+
+static size_t __myfs_pool_report(char *buf, size_t len, void *arg) {
+  static const char *names[MYFS_Q_COUNT] = { "metadata", "data" };
+  struct __myfs_pool_struct_t *pool;
+  double uptime;
+  size_t out, i;
+  int q;
+
+#define EMIT(...)  out += snprintf((out < len) ? buf + out : NULL, (out < len) ? len - out : 0, __VA_ARGS__)
+  pool = (struct __myfs_pool_struct_t *) arg;
+  out = 0;
+  pthread_mutex_lock(&(pool->lock));
+  uptime = (double) (stat_now() - pool->start);
+  EMIT("\n%-10s %12s %10s %10s %10s %10s\n", "queue", "requests", "depth", "mean", "max", "wait");
+  for (q = 0; q < MYFS_Q_COUNT; q++) {
+    EMIT("%-10s %12lu %10zu %10.2f %10zu %10.2f\n", names[q], (unsigned long) pool->queued[q], pool->depth[q],
+         (pool->queued[q] > 0) ? (double) pool->depthsum[q] / pool->queued[q] : 0.0, pool->maxdepth[q],
+         (pool->queued[q] > 0) ? pool->waited[q] / 1e3 / pool->queued[q] : 0.0);
+  }
+  EMIT("\n%-10s %12s %10s\n", "worker", "requests", "busy %");
+  for (i = 0; i < pool->count; i++) {
+    EMIT("%-10zu %12lu %10.1f\n", i, (unsigned long) pool->workers[i].requests,
+         (uptime > 0) ? 100.0 * pool->workers[i].busy / uptime : 0.0);
+  }
+  pthread_mutex_unlock(&(pool->lock));
+#undef EMIT
+  return out;
+}
+
+/* Serves the session se until it is exited or unmounted, returns 0
+   on a clean exit, -1 otherwise */
+static int __myfs_serve(struct fuse_session *se, struct __myfs_environment_struct_t *env, int multithreaded) {
+  struct __myfs_pool_struct_t pool;
+  struct fuse_chan *ch, *tmpch;
+  sigset_t all, old;
+  myfs_sreq_t *req;
+  size_t bufsize, i;
+  int res, q, err;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.se = se;
+  pool.count = multithreaded ? env->workers : 1;
+  pool.start = stat_now();
+  if ((pool.workers = calloc(pool.count, sizeof(struct __myfs_worker_struct_t))) == NULL) return -1;
+  pthread_mutex_init(&(pool.lock), NULL);
+  pthread_cond_init(&(pool.work), NULL);
+  ch = fuse_session_next_chan(se, NULL);
+  bufsize = fuse_chan_bufsize(ch);
+
+  /* Signals are left to this thread, where they interrupt the
+     read from the kernel so the loop sees the session exited */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (i = 0; i < pool.count; i++) {
+    pool.workers[i].pool = &pool;
+    pool.workers[i].cpu = (env->ncpus > 0) ? env->cpus[i % env->ncpus] : -1;
+    if (pthread_create(&(pool.workers[i].thread), NULL, __myfs_pool_worker, &(pool.workers[i])) != 0) break;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (i < pool.count) fprintf(stderr, "Cannot start all workers, running %zu\n", i);
+  pool.count = i;
+  stat_extra(__myfs_pool_report, &pool);
+
+  err = (pool.count == 0) ? -1 : 0;
+  while ((err == 0) && !fuse_session_exited(se)) {
+    pthread_mutex_lock(&(pool.lock));
+    if ((req = pool.free) != NULL) pool.free = req->next;
+    pthread_mutex_unlock(&(pool.lock));
+    if ((req == NULL) && ((req = malloc(sizeof(myfs_sreq_t) + bufsize)) == NULL)) {
+      err = -1;
+      break;
+    }
+    tmpch = ch;
+    res = fuse_chan_recv(&tmpch, req->buf, bufsize);
+    if (res <= 0) {
+      pthread_mutex_lock(&(pool.lock));
+      req->next = pool.free;
+      pool.free = req;
+      pthread_mutex_unlock(&(pool.lock));
+      if (res == -EINTR) continue;
+      if (res < 0) err = -1;
+      break;
+    }
+    req->ch = tmpch;
+    req->len = (size_t) res;
+    req->next = NULL;
+    q = __myfs_pool_class(req->buf, req->len);
+    pthread_mutex_lock(&(pool.lock));
+    req->queued = stat_now();
+    if (pool.tail[q] != NULL) pool.tail[q]->next = req;
+    else pool.head[q] = req;
+    pool.tail[q] = req;
+    if (++(pool.depth[q]) > pool.maxdepth[q]) pool.maxdepth[q] = pool.depth[q];
+    pool.depthsum[q] += pool.depth[q];
+    pool.queued[q]++;
+    pthread_cond_signal(&(pool.work));
+    pthread_mutex_unlock(&(pool.lock));
+  }
+
+  /* Workers finish what was queued before they leave */
+  pthread_mutex_lock(&(pool.lock));
+  pool.stop = 1;
+  pthread_cond_broadcast(&(pool.work));
+  pthread_mutex_unlock(&(pool.lock));
+  for (i = 0; i < pool.count; i++) pthread_join(pool.workers[i].thread, NULL);
+  stat_extra(NULL, NULL);
+  while ((req = pool.free) != NULL) {
+    pool.free = req->next;
+    free(req);
+  }
+  pthread_cond_destroy(&(pool.work));
+  pthread_mutex_destroy(&(pool.lock));
+  free(pool.workers);
+  fuse_session_reset(se);
+  return err;
+}
+
+/* Mounts and serves the filesystem with the path API, as fuse_main
+   does it but with the session loop above */
+static int __myfs_hl_main(struct fuse_args *args, struct __myfs_environment_struct_t *env) {
+  struct fuse *fuse;
+  char *mountpoint;
+  int multithreaded, err;
+
+  fuse = fuse_setup(args->argc, args->argv, &__myfs_operations, sizeof(__myfs_operations),
+                    &mountpoint, &multithreaded, env);
+  if (fuse == NULL) {
+    fuse_opt_free_args(args);
+    return 1;
+  }
+  err = __myfs_serve(fuse_get_session(fuse), env, multithreaded);
+  fuse_teardown(fuse, mountpoint);
+  fuse_opt_free_args(args);
+  return (err == 0) ? 0 : 1;
+}
+
+/* End of session loop part */
+
+/* Low-level frontend part
+
+   With --lowlevel the filesystem is served through the low-level
+   FUSE API instead of fuse_main: the kernel names files by the
+   inode numbers lookup gave it, which map straight to nodes of the
+   image, so no operation resolves a path. An inode number is the
+   node plus one, FUSE_ROOT_ID being the root node 0, with the
+   node's generation in the upper 32 bits. A node's generation is
+   counted up whenever it is created anew, so an inode number the
+   kernel kept for a removed file never reaches the file that
+   reuses the node, it fails with ESTALE instead.
+
+   The kernel's references to each node are counted from the
+   replies of lookup, mknod and mkdir down to forget. An unlinked
+   file keeps its blocks while it is referenced, so open files can
+   still be read and written, and is freed with the last forget or
+   at unmount. Generations and references are kept in process
+   memory, grown as nodes are handed out and only touched with
+   env_lock held.
+
+   The virtual /.myfs directory and its stats file have inode
+   numbers of their own, with a generation no node reaches.
+*/
+
+#define MYFS_LL_NODES  ((size_t) 1024)
+#define MYFS_LL_VGEN   ((uint32_t) 0xffffffff)
+#define MYFS_LL_VDIR   ((((fuse_ino_t) MYFS_LL_VGEN) << 32) | 1)
+#define MYFS_LL_VFILE  ((((fuse_ino_t) MYFS_LL_VGEN) << 32) | 2)
+
+struct __myfs_ll_dirbuf_struct_t {
+  size_t len;
+  size_t cap;
+  char   *data;
+};
+typedef struct __myfs_ll_dirbuf_struct_t myfs_ll_dirbuf_t;
+
+static struct __myfs_environment_struct_t *__myfs_ll_env(fuse_req_t req) {
+  return (struct __myfs_environment_struct_t *) fuse_req_userdata(req);
+}
+
+/* Makes room in the generation and reference tables for node */
+static int __myfs_ll_track(struct __myfs_environment_struct_t *env, uint64_t node) {
+  uint32_t *gen;
+  uint64_t *refs;
+  size_t count;
+
+  if (node < env->ll_count) return 0;
+  count = (env->ll_count == 0) ? MYFS_LL_NODES : env->ll_count;
+  while (count <= node) count *= 2;
+  if ((gen = realloc(env->ll_gen, count * sizeof(uint32_t))) == NULL) return -1;
+  env->ll_gen = gen;
+  if ((refs = realloc(env->ll_refs, count * sizeof(uint64_t))) == NULL) return -1;
+  env->ll_refs = refs;
+  memset(gen + env->ll_count, 0, (count - env->ll_count) * sizeof(uint32_t));
+  memset(refs + env->ll_count, 0, (count - env->ll_count) * sizeof(uint64_t));
+  env->ll_count = count;
+  return 0;
+}
+
+static fuse_ino_t __myfs_ll_ino(struct __myfs_environment_struct_t *env, uint64_t node) {
+  uint32_t gen;
+
+  gen = (node < env->ll_count) ? env->ll_gen[node] : 0;
+  return (((fuse_ino_t) gen) << 32) | ((fuse_ino_t) (node + 1));
+}
+
+/* Puts the node of ino into *node, fails with ESTALE when the node
+   was created anew since the kernel was given ino */
+static int __myfs_ll_node(struct __myfs_environment_struct_t *env, fuse_ino_t ino,
+                          uint64_t *node, int *errnoptr) {
+  uint64_t n;
+  uint32_t gen;
+
+  n = (uint64_t) (ino & 0xffffffff);
+  gen = (uint32_t) (((uint64_t) ino) >> 32);
+  if ((n == 0) || (gen != ((n - 1 < env->ll_count) ? env->ll_gen[n - 1] : 0))) {
+    *errnoptr = ESTALE;
+    return -1;
+  }
+  *node = n - 1;
+  return 0;
+}
+
+static int __myfs_ll_virtual(fuse_ino_t parent, const char *name) {
+  if (parent == MYFS_LL_VDIR)
+    return (strcmp(name, MYFS_STATS_FILE + sizeof(MYFS_STATS_DIR)) == 0) ? MYFS_VIRTUAL_FILE : MYFS_VIRTUAL_NONE;
+  if ((parent == FUSE_ROOT_ID) && (strcmp(name, MYFS_STATS_DIR + 1) == 0)) return MYFS_VIRTUAL_DIR;
+  return 0;
+}
+
+static int __myfs_ll_vkind(fuse_ino_t ino) {
+  if (ino == MYFS_LL_VDIR) return MYFS_VIRTUAL_DIR;
+  if (ino == MYFS_LL_VFILE) return MYFS_VIRTUAL_FILE;
+  return 0;
+}
+
+/* Attributes of node as getattr gives them, buffered data included */
+static int __myfs_ll_attr(struct __myfs_environment_struct_t *env, uint64_t node,
+                          struct stat *st, int *errnoptr) {
+  myfs_wbuf_t **link;
+
+  memset(st, 0, sizeof(struct stat));
+  if (__myfs_getattr_node_implem(env->memory, env->size, errnoptr, env->uid, env->gid, node, st) < 0)
+    return -1;
+  if ((link = __myfs_wb_find_node(env, node)) != NULL) {
+    if (st->st_size < (*link)->off + (off_t) (*link)->len)
+      st->st_size = (*link)->off + (off_t) (*link)->len;
+    st->st_mtim = (*link)->mtime;
+  }
+  st->st_ino = __myfs_ll_ino(env, node);
+  return 0;
+}
+
+/* Fills e for node and counts the reference the reply gives the
+   kernel, fresh is set for a node just created */
+static int __myfs_ll_entry(struct __myfs_environment_struct_t *env, uint64_t node, int fresh,
+                           struct fuse_entry_param *e, int *errnoptr) {
+  if (__myfs_ll_track(env, node) < 0) {
+    *errnoptr = ENOMEM;
+    return -1;
+  }
+  if (fresh) {
+    if (++(env->ll_gen[node]) == MYFS_LL_VGEN) env->ll_gen[node]++;
+    env->ll_refs[node] = 0;
+  }
+  if (__myfs_ll_attr(env, node, &(e->attr), errnoptr) < 0) return -1;
+  e->ino = e->attr.st_ino;
+  e->generation = env->ll_gen[node];
+  e->attr_timeout = (double) env->cache_timeout;
+  e->entry_timeout = (double) env->cache_timeout;
+  env->ll_refs[node]++;
+  return 0;
+}
+
+/* Drops count references of the kernel to ino, an unlinked file
+   is freed with the last one */
+static void __myfs_ll_unref(struct __myfs_environment_struct_t *env, fuse_ino_t ino, uint64_t count) {
+  myfs_wbuf_t **link;
+  struct stat st;
+  uint64_t node;
+  int err;
+
+  if ((__myfs_ll_node(env, ino, &node, &err) < 0) || (node >= env->ll_count)) return;
+  env->ll_refs[node] -= (count < env->ll_refs[node]) ? count : env->ll_refs[node];
+  if (env->ll_refs[node] > 0) return;
+  if ((__myfs_getattr_node_implem(env->memory, env->size, &err, env->uid, env->gid, node, &st) < 0) ||
+      (st.st_nlink > 0)) return;
+  if ((link = __myfs_wb_find_node(env, node)) != NULL) __myfs_wb_drop(env, link);
+  if (__myfs_forget_implem(env->memory, env->size, &err, node) >= 0) __myfs_reclaim_kick(env);
+}
+
+static int __myfs_ll_dirbuf_add(fuse_req_t req, myfs_ll_dirbuf_t *b, const char *name, fuse_ino_t ino) {
+  struct stat st;
+  size_t len, cap;
+  char *data;
+
+  memset(&st, 0, sizeof(struct stat));
+  st.st_ino = ino;
+  len = fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+  if (b->len + len > b->cap) {
+    cap = (b->cap == 0) ? 4096 : b->cap;
+    while (cap < b->len + len) cap *= 2;
+    if ((data = realloc(b->data, cap)) == NULL) return -1;
+    b->data = data;
+    b->cap = cap;
+  }
+  fuse_add_direntry(req, b->data + b->len, len, name, &st, b->len + len);
+  b->len += len;
+  return 0;
+}
+
+static void __myfs_ll_init(void *userdata, struct fuse_conn_info *conn) {
+  __myfs_conn_setup((struct __myfs_environment_struct_t *) userdata, conn);
+  __myfs_start((struct __myfs_environment_struct_t *) userdata);
+}
+
+static void __myfs_ll_destroy(void *userdata) {
+  struct __myfs_environment_struct_t *env;
+  uint64_t node;
+
+  env = (struct __myfs_environment_struct_t *) userdata;
+  if (env == NULL) return;
+  pthread_mutex_lock(&(env->env_lock));
+  for (node = 0; node < env->ll_count; node++) {
+    if (env->ll_refs[node] > 0) __myfs_ll_unref(env, __myfs_ll_ino(env, node), env->ll_refs[node]);
+  }
+  free(env->ll_gen);
+  free(env->ll_refs);
+  env->ll_gen = NULL;
+  env->ll_refs = NULL;
+  env->ll_count = 0;
+  pthread_mutex_unlock(&(env->env_lock));
+  __myfs_stop(env);
+}
+
+static void __myfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+  struct __myfs_environment_struct_t *env;
+  struct fuse_entry_param e;
+  int __myfs_errno, res, kind;
+  uint64_t stat_start, dir, node;
+
+  env = __myfs_ll_env(req);
+  memset(&e, 0, sizeof(e));
+
+  if ((kind = __myfs_ll_virtual(parent, name)) != 0) {
+    if (kind == MYFS_VIRTUAL_NONE) {
+      fuse_reply_err(req, ENOENT);
+      return;
+    }
+    __myfs_virtual_getattr(env, kind, &(e.attr));
+    e.ino = (kind == MYFS_VIRTUAL_DIR) ? MYFS_LL_VDIR : MYFS_LL_VFILE;
+    e.attr.st_ino = e.ino;
+    e.entry_timeout = (double) env->cache_timeout;
+    fuse_reply_entry(req, &e);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, parent, &dir, &__myfs_errno);
+  if (res >= 0) res = __myfs_lookup_implem(env->memory, env->size, &__myfs_errno, dir, name, &node);
+  if (res >= 0) res = __myfs_ll_entry(env, node, 0, &e, &__myfs_errno);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_LOOKUP, stat_start, res < 0);
+  if (res >= 0) {
+    fuse_reply_entry(req, &e);
+  } else if (__myfs_errno == ENOENT) {
+    /* A negative entry, the kernel remembers the name is missing */
+    memset(&e, 0, sizeof(e));
+    e.entry_timeout = (double) env->cache_timeout;
+    fuse_reply_entry(req, &e);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+static void __myfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+  struct __myfs_environment_struct_t *env;
+  uint64_t stat_start;
+
+  env = __myfs_ll_env(req);
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  __myfs_ll_unref(env, ino, nlookup);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_FORGET, stat_start, 0);
+  fuse_reply_none(req);
+}
+
+static void __myfs_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets) {
+  struct __myfs_environment_struct_t *env;
+  uint64_t stat_start;
+  size_t i;
+
+  env = __myfs_ll_env(req);
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  for (i = 0; i < count; i++) __myfs_ll_unref(env, (fuse_ino_t) forgets[i].ino, forgets[i].nlookup);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_FORGET, stat_start, 0);
+  fuse_reply_none(req);
+}
+
+static void __myfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  struct stat st;
+  int __myfs_errno, res, kind;
+  uint64_t stat_start, node;
+
+  (void) fi;
+
+  env = __myfs_ll_env(req);
+
+  if ((kind = __myfs_ll_vkind(ino)) != 0) {
+    memset(&st, 0, sizeof(struct stat));
+    __myfs_virtual_getattr(env, kind, &st);
+    st.st_ino = ino;
+    fuse_reply_attr(req, &st, 0.0);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if (res >= 0) res = __myfs_ll_attr(env, node, &st, &__myfs_errno);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_GETATTR, stat_start, res < 0);
+  if (res >= 0) {
+    fuse_reply_attr(req, &st, (double) env->cache_timeout);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+/* Changes the size and times, the only attributes the image has,
+   changing the mode or owner is not supported, as with the path
+   frontend */
+static void __myfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+                              struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  struct timespec ts[2], now;
+  struct stat st;
+  int __myfs_errno, res, op;
+  uint64_t stat_start, node;
+  myfs_wbuf_t **link;
+
+  (void) fi;
+
+  env = __myfs_ll_env(req);
+
+  if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+    fuse_reply_err(req, ENOSYS);
+    return;
+  }
+  if (__myfs_ll_vkind(ino)) {
+    fuse_reply_err(req, EACCES);
+    return;
+  }
+
+  op = ST_GETATTR;
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if ((res >= 0) && (to_set & FUSE_SET_ATTR_SIZE)) {
+    op = ST_TRUNCATE;
+    if ((link = __myfs_wb_find_node(env, node)) != NULL) {
+      if (attr->st_size <= (*link)->off) __myfs_wb_drop(env, link);
+      else res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+    }
+    if (res >= 0) res = __myfs_truncate_node_implem(env->memory, env->size, &__myfs_errno, node, attr->st_size);
+    if (res >= 0) __myfs_reclaim_kick(env);
+  }
+  if ((res >= 0) && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME |
+                               FUSE_SET_ATTR_ATIME_NOW | FUSE_SET_ATTR_MTIME_NOW))) {
+    if (op == ST_GETATTR) op = ST_UTIMENS;
+    /* Buffered data would otherwise stamp the file again when flushed */
+    if ((link = __myfs_wb_find_node(env, node)) != NULL) res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+    if (res >= 0) res = __myfs_ll_attr(env, node, &st, &__myfs_errno);
+    if (res >= 0) {
+      clock_gettime(CLOCK_REALTIME, &now);
+      ts[0] = (to_set & FUSE_SET_ATTR_ATIME_NOW) ? now : ((to_set & FUSE_SET_ATTR_ATIME) ? attr->st_atim : st.st_atim);
+      ts[1] = (to_set & FUSE_SET_ATTR_MTIME_NOW) ? now : ((to_set & FUSE_SET_ATTR_MTIME) ? attr->st_mtim : st.st_mtim);
+      res = __myfs_utimens_node_implem(env->memory, env->size, &__myfs_errno, node, ts);
+    }
+  }
+  if (res >= 0) res = __myfs_ll_attr(env, node, &st, &__myfs_errno);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(op, stat_start, res < 0);
+  if (res >= 0) {
+    fuse_reply_attr(req, &st, (double) env->cache_timeout);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+/* mknod and mkdir, the callbacks differ only in the implementation
+   they call */
+static void __myfs_ll_make(fuse_req_t req, fuse_ino_t parent, const char *name, int op) {
+  struct __myfs_environment_struct_t *env;
+  struct fuse_entry_param e;
+  int __myfs_errno, res;
+  uint64_t stat_start, dir, node;
+
+  env = __myfs_ll_env(req);
+  memset(&e, 0, sizeof(e));
+
+  if (__myfs_ll_vkind(parent) || __myfs_ll_virtual(parent, name)) {
+    fuse_reply_err(req, EACCES);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, parent, &dir, &__myfs_errno);
+  if (res >= 0) {
+    if (op == ST_MKDIR) {
+      res = __myfs_mkdir_node_implem(env->memory, env->size, &__myfs_errno, dir, name, &node);
+    } else {
+      res = __myfs_mknod_node_implem(env->memory, env->size, &__myfs_errno, dir, name, &node);
+    }
+  }
+  if (res >= 0) res = __myfs_ll_entry(env, node, 1, &e, &__myfs_errno);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(op, stat_start, res < 0);
+  if (res >= 0) {
+    fuse_reply_entry(req, &e);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+static void __myfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev) {
+  (void) rdev;
+
+  if (!S_ISREG(mode)) {
+    fuse_reply_err(req, EPERM);
+    return;
+  }
+  __myfs_ll_make(req, parent, name, ST_MKNOD);
+}
+
+static void __myfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+  (void) mode;
+
+  __myfs_ll_make(req, parent, name, ST_MKDIR);
+}
+
+static void __myfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, dir, node;
+
+  env = __myfs_ll_env(req);
+
+  if (__myfs_ll_vkind(parent) || __myfs_ll_virtual(parent, name)) {
+    fuse_reply_err(req, EACCES);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, parent, &dir, &__myfs_errno);
+  if (res >= 0) res = __myfs_unlink_node_implem(env->memory, env->size, &__myfs_errno, dir, name, &node);
+  /* Not referenced by the kernel, nothing waits for a forget */
+  if ((res >= 0) && ((node >= env->ll_count) || (env->ll_refs[node] == 0)))
+    __myfs_ll_unref(env, __myfs_ll_ino(env, node), 0);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_UNLINK, stat_start, res < 0);
+  fuse_reply_err(req, (res >= 0) ? 0 : __myfs_errno);
+}
+
+static void __myfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, dir;
+
+  env = __myfs_ll_env(req);
+
+  if (__myfs_ll_vkind(parent) || __myfs_ll_virtual(parent, name)) {
+    fuse_reply_err(req, EACCES);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, parent, &dir, &__myfs_errno);
+  if (res >= 0) res = __myfs_rmdir_node_implem(env->memory, env->size, &__myfs_errno, dir, name);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_RMDIR, stat_start, res < 0);
+  fuse_reply_err(req, (res >= 0) ? 0 : __myfs_errno);
+}
+
+static void __myfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                             fuse_ino_t newparent, const char *newname) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, dir, newdir;
+
+  env = __myfs_ll_env(req);
+
+  if (__myfs_ll_vkind(parent) || __myfs_ll_virtual(parent, name) ||
+      __myfs_ll_vkind(newparent) || __myfs_ll_virtual(newparent, newname)) {
+    fuse_reply_err(req, EACCES);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, parent, &dir, &__myfs_errno);
+  if (res >= 0) res = __myfs_ll_node(env, newparent, &newdir, &__myfs_errno);
+  if (res >= 0) res = __myfs_rename_node_implem(env->memory, env->size, &__myfs_errno,
+                                                dir, name, newdir, newname);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_RENAME, stat_start, res < 0);
+  fuse_reply_err(req, (res >= 0) ? 0 : __myfs_errno);
+}
+
+static void __myfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res, kind;
+  uint64_t stat_start, node;
+
+  env = __myfs_ll_env(req);
+
+  if (!(((fi->flags & O_ACCMODE) == O_RDONLY) ||
+        ((fi->flags & O_ACCMODE) == O_WRONLY) ||
+        ((fi->flags & O_ACCMODE) == O_RDWR))) {
+    fuse_reply_err(req, EINVAL);
+    return;
+  }
+  if ((kind = __myfs_ll_vkind(ino)) != 0) {
+    res = (kind == MYFS_VIRTUAL_FILE) ? __myfs_virtual_open(fi) : -EISDIR;
+    if (res < 0) fuse_reply_err(req, -res);
+    else fuse_reply_open(req, fi);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if (res >= 0) res = __myfs_open_node_implem(env->memory, env->size, &__myfs_errno, node);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_OPEN, stat_start, res < 0);
+  if (res >= 0) {
+    fi->fh = __myfs_ra_open(env, fi->flags);
+    fuse_reply_open(req, fi);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+static void __myfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                           struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, node;
+  myfs_wbuf_t **link;
+  char *buf;
+  size_t ra_starts[MYFS_RA_RUNS], ra_lens[MYFS_RA_RUNS];
+  int ra_runs;
+
+  env = __myfs_ll_env(req);
+
+  if ((buf = malloc((size > 0) ? size : 1)) == NULL) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+  if (__myfs_ll_vkind(ino) == MYFS_VIRTUAL_FILE) {
+    res = __myfs_virtual_read(buf, size, offset, fi);
+    if (res < 0) fuse_reply_err(req, -res);
+    else fuse_reply_buf(req, buf, res);
+    free(buf);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if ((res >= 0) && ((link = __myfs_wb_find_node(env, node)) != NULL) && (offset + (off_t) size > (*link)->off))
+    res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+  if (res >= 0) res = __myfs_read_node_implem(env->memory, env->size, &__myfs_errno, node, buf, size, offset);
+  ra_runs = (res > 0) ? __myfs_ra_find(env, fi->fh, NULL, node, offset, size, ra_starts, ra_lens) : 0;
+  pthread_mutex_unlock(&(env->env_lock));
+  __myfs_ra_advise(env, ra_starts, ra_lens, ra_runs);
+  stat_end(ST_READ, stat_start, res < 0);
+  if (res >= 0) {
+    fuse_reply_buf(req, buf, res);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+  free(buf);
+}
+
+static void __myfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset,
+                            struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, node;
+
+  (void) fi;
+
+  env = __myfs_ll_env(req);
+
+  if (__myfs_ll_vkind(ino)) {
+    fuse_reply_err(req, EACCES);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if (res >= 0) res = __myfs_wb_write(env, NULL, node, buf, size, offset, &__myfs_errno);
+  if (res == MYFS_WB_DIRECT) res = __myfs_write_node_implem(env->memory, env->size, &__myfs_errno,
+                                                            node, buf, size, offset);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_WRITE, stat_start, res < 0);
+  if (res >= 0) {
+    fuse_reply_write(req, res);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+static void __myfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, node;
+  myfs_wbuf_t **link;
+
+  env = __myfs_ll_env(req);
+
+  stat_start = stat_now();
+  if (__myfs_ll_vkind(ino) == MYFS_VIRTUAL_FILE) {
+    free((void *) (uintptr_t) fi->fh);
+    fi->fh = 0;
+    stat_end(ST_RELEASE, stat_start, 0);
+    fuse_reply_err(req, 0);
+    return;
+  }
+  free((void *) (uintptr_t) fi->fh);
+  fi->fh = 0;
+  __myfs_errno = ENOENT;
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if ((res >= 0) && ((link = __myfs_wb_find_node(env, node)) != NULL))
+    res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+  if (res >= 0) __myfs_release_node_implem(env->memory, env->size, &__myfs_errno, node);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_RELEASE, stat_start, res < 0);
+  fuse_reply_err(req, (res >= 0) ? 0 : __myfs_errno);
+}
+
+static void __myfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, node;
+  myfs_wbuf_t **link;
+
+  (void) datasync;
+  (void) fi;
+
+  env = __myfs_ll_env(req);
+
+  __myfs_errno = EIO;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if ((res >= 0) && ((link = __myfs_wb_find_node(env, node)) != NULL))
+    res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+  if (res >= 0) {
+    __myfs_release_node_implem(env->memory, env->size, &__myfs_errno, node);
+    __myfs_errno = EIO;
+    res = __myfs_sync_environment(env);
+  }
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_FSYNC, stat_start, res < 0);
+  fuse_reply_err(req, (res >= 0) ? 0 : __myfs_errno);
+}
+
+/* The listing is taken whole on opendir and handed out in pieces
+   by readdir, so a directory changing in between is seen the same
+   way as with the path frontend */
+static void __myfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  myfs_ll_dirbuf_t *b;
+  int __myfs_errno, res, i, err;
+  uint64_t stat_start, dir, *nodes;
+  fuse_ino_t *inos;
+  char **names;
+
+  env = __myfs_ll_env(req);
+
+  if ((b = calloc(1, sizeof(myfs_ll_dirbuf_t))) == NULL) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+  if (__myfs_ll_vkind(ino) == MYFS_VIRTUAL_FILE) {
+    free(b);
+    fuse_reply_err(req, ENOTDIR);
+    return;
+  }
+  if (ino == MYFS_LL_VDIR) {
+    err = __myfs_ll_dirbuf_add(req, b, ".", MYFS_LL_VDIR);
+    if (err == 0) err = __myfs_ll_dirbuf_add(req, b, "..", FUSE_ROOT_ID);
+    if (err == 0) err = __myfs_ll_dirbuf_add(req, b, MYFS_STATS_FILE + sizeof(MYFS_STATS_DIR), MYFS_LL_VFILE);
+    if (err < 0) {
+      free(b->data);
+      free(b);
+      fuse_reply_err(req, ENOMEM);
+      return;
+    }
+    fi->fh = (uint64_t) (uintptr_t) b;
+    fuse_reply_open(req, fi);
+    return;
+  }
+
+  names = NULL;
+  nodes = NULL;
+  inos = NULL;
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &dir, &__myfs_errno);
+  if (res >= 0) res = __myfs_readdir_node_implem(env->memory, env->size, &__myfs_errno, dir, &names, &nodes);
+  if ((res > 0) && ((inos = malloc(res * sizeof(fuse_ino_t))) != NULL)) {
+    for (i = 0; i < res; i++) inos[i] = __myfs_ll_ino(env, nodes[i]);
+  }
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_READDIR, stat_start, res < 0);
+  if ((res > 0) && (inos == NULL)) {
+    __myfs_errno = ENOMEM;
+    for (i = 0; i < res; i++) free(names[i]);
+    res = -1;
+  }
+  err = 0;
+  if (res >= 0) {
+    /* Directories do not record their parent, so only the root,
+       its own parent, lists "..", the kernel resolves it itself */
+    err = __myfs_ll_dirbuf_add(req, b, ".", ino);
+    if ((err == 0) && (ino == FUSE_ROOT_ID)) err = __myfs_ll_dirbuf_add(req, b, "..", FUSE_ROOT_ID);
+    for (i = 0; i < res; i++) {
+      if (err == 0) err = __myfs_ll_dirbuf_add(req, b, names[i], inos[i]);
+      free(names[i]);
+    }
+  }
+  if ((res >= 0) && (err < 0)) {
+    __myfs_errno = ENOMEM;
+    res = -1;
+  }
+  free(names);
+  free(nodes);
+  free(inos);
+  if (res >= 0) {
+    fi->fh = (uint64_t) (uintptr_t) b;
+    fuse_reply_open(req, fi);
+  } else {
+    free(b->data);
+    free(b);
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+static void __myfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                              struct fuse_file_info *fi) {
+  myfs_ll_dirbuf_t *b;
+
+  (void) ino;
+
+  b = (myfs_ll_dirbuf_t *) (uintptr_t) fi->fh;
+  if ((offset < 0) || ((size_t) offset >= b->len)) {
+    fuse_reply_buf(req, NULL, 0);
+    return;
+  }
+  if (size > b->len - offset) size = b->len - offset;
+  fuse_reply_buf(req, b->data + offset, size);
+}
+
+static void __myfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+  myfs_ll_dirbuf_t *b;
+
+  (void) ino;
+
+  b = (myfs_ll_dirbuf_t *) (uintptr_t) fi->fh;
+  free(b->data);
+  free(b);
+  fuse_reply_err(req, 0);
+}
+
+static void __myfs_ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+  struct __myfs_environment_struct_t *env;
+  struct statvfs stbuf;
+  int __myfs_errno, res;
+  uint64_t stat_start;
+
+  (void) ino;
+
+  env = __myfs_ll_env(req);
+  memset(&stbuf, 0, sizeof(struct statvfs));
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_statfs_implem(env->memory, env->size, &__myfs_errno, &stbuf);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_STATFS, stat_start, res < 0);
+  if (res >= 0) {
+    fuse_reply_statfs(req, &stbuf);
+  } else {
+    fuse_reply_err(req, __myfs_errno);
+  }
+}
+
+static void __myfs_ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length,
+                                struct fuse_file_info *fi) {
+  struct __myfs_environment_struct_t *env;
+  int __myfs_errno, res;
+  uint64_t stat_start, node;
+  myfs_wbuf_t **link;
+
+  (void) fi;
+
+  env = __myfs_ll_env(req);
+
+  if (__myfs_ll_vkind(ino)) {
+    fuse_reply_err(req, EACCES);
+    return;
+  }
+
+  __myfs_errno = ENOENT;
+  stat_start = stat_now();
+  pthread_mutex_lock(&(env->env_lock));
+  res = __myfs_ll_node(env, ino, &node, &__myfs_errno);
+  if ((res >= 0) && ((link = __myfs_wb_find_node(env, node)) != NULL))
+    res = __myfs_wb_flush(env, link, &__myfs_errno, 0);
+  if (res >= 0) res = __myfs_fallocate_node_implem(env->memory, env->size, &__myfs_errno,
+                                                   node, mode, offset, length);
+  pthread_mutex_unlock(&(env->env_lock));
+  stat_end(ST_FALLOCATE, stat_start, res < 0);
+  fuse_reply_err(req, (res >= 0) ? 0 : __myfs_errno);
+}
+
+static struct fuse_lowlevel_ops __myfs_ll_operations = {
+  .init = __myfs_ll_init,
+  .destroy = __myfs_ll_destroy,
+  .lookup = __myfs_ll_lookup,
+  .forget = __myfs_ll_forget,
+  .forget_multi = __myfs_ll_forget_multi,
+  .getattr = __myfs_ll_getattr,
+  .setattr = __myfs_ll_setattr,
+  .mknod = __myfs_ll_mknod,
+  .mkdir = __myfs_ll_mkdir,
+  .unlink = __myfs_ll_unlink,
+  .rmdir = __myfs_ll_rmdir,
+  .rename = __myfs_ll_rename,
+  .open = __myfs_ll_open,
+  .read = __myfs_ll_read,
+  .write = __myfs_ll_write,
+  .release = __myfs_ll_release,
+  .fsync = __myfs_ll_fsync,
+  .opendir = __myfs_ll_opendir,
+  .readdir = __myfs_ll_readdir,
+  .releasedir = __myfs_ll_releasedir,
+  .statfs = __myfs_ll_statfs,
+  .fallocate = __myfs_ll_fallocate
+};
+
+/* Mounts and serves the filesystem with the low-level API, the
+   same way fuse_main does it for the path frontend */
+static int __myfs_ll_main(struct fuse_args *args, struct __myfs_environment_struct_t *env) {
+  struct fuse_session *se;
+  struct fuse_chan *ch;
+  char *mountpoint;
+  int multithreaded, foreground, err;
+
+  err = -1;
+  mountpoint = NULL;
+  if ((fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) != -1) &&
+      ((ch = fuse_mount(mountpoint, args)) != NULL)) {
+    se = fuse_lowlevel_new(args, &__myfs_ll_operations, sizeof(__myfs_ll_operations), env);
+    if (se != NULL) {
+      if (fuse_set_signal_handlers(se) != -1) {
+        fuse_session_add_chan(se, ch);
+        if (fuse_daemonize(foreground) != -1)
+          err = __myfs_serve(se, env, multithreaded);
+        fuse_remove_signal_handlers(se);
+        fuse_session_remove_chan(ch);
+      }
+      fuse_session_destroy(se);
+    }
+    fuse_unmount(mountpoint, ch);
+  }
+  free(mountpoint);
+  fuse_opt_free_args(args);
+  return (err == 0) ? 0 : 1;
+}
+
+/* End of low-level frontend part */
+
 static void __myfs_show_help(const char *name) {
         printf("usage: %s [options] <mountpoint>\n\n", name);
         printf("File-system specific options:\n"
@@ -662,6 +3030,45 @@ static void __myfs_show_help(const char *name) {
                "                            backup-file and the size specified.\n"
                "                            The minimum size of a filesystem is 2kB. If a\n"
                "                            lesser size is used, it is increased to 2kB.\n"
+               "    --statslog=<s>          File the stats report is appended to on SIGUSR1\n"
+               "                            Default: standard error (only visible with -f)\n"
+               "                            The same report can be read from /.myfs/stats\n"
+               "    --trace=<s>             File to record every operation to, for replay\n"
+               "                            Default: none, no tracing\n"
+               "    --tracesize=<s>         Size of the trace file, a ring buffer that keeps\n"
+               "                            the most recent operations once it is full\n"
+               "                            Default: 64MB, about a million operations\n"
+               "    --writeback=<s>         Bytes of appended data buffered per file before\n"
+               "                            blocks are allocated for them, 0 to write through\n"
+               "                            Default: 4MB\n"
+               "    --defrag=<n>            Blocks per second moved in the background to make\n"
+               "                            fragmented files contiguous again\n"
+               "                            Default: 0, no defragmentation\n"
+               "    --cache=<n>             Seconds the kernel may keep attributes and names\n"
+               "                            it looked up before asking again, 0 to always ask\n"
+               "                            Default: 60\n"
+               "    --iosize=<s>            Largest read and write request the kernel is asked\n"
+               "                            to send, at most 1MB, kernels without larger\n"
+               "                            requests stop at 128kB\n"
+               "                            Default: 1MB\n"
+               "    --workload=<s>          How files are read: random, sequential or normal,\n"
+               "                            given to the kernel for the whole image\n"
+               "                            Default: normal\n"
+               "    --hugepages=<s>         Pages backing an image without a backup-file:\n"
+               "                            hugetlb from the reserved pool, thp for\n"
+               "                            transparent huge pages, or none\n"
+               "                            Default: none\n"
+               "    --prefault              Fault in the header and node table at mount\n"
+               "    --workers=<n>           Threads processing requests, -s runs one\n"
+               "                            Default: 4\n"
+               "    --cpus=<list>           CPUs the workers are pinned to, such as 0-3,8\n"
+               "                            Default: none, workers are not pinned\n"
+               "    --wbcache               Let the kernel cache writes and send them a page\n"
+               "                            or more at a time, needs a libfuse that can ask\n"
+               "                            for it (FUSE_CAP_WRITEBACK_CACHE)\n"
+               "    --lowlevel              Serve files by inode number through the low-level\n"
+               "                            FUSE API instead of by path, --trace is not\n"
+               "                            available with it\n"
                "\n");
 }
 
@@ -670,10 +3077,27 @@ int main(int argc, char *argv[]) {
   struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
   struct __myfs_environment_struct_t __myfs_environment;
   struct __myfs_environment_struct_t *env_ptr = NULL;
+  sigset_t sigs;
+  char cacheopt[64];
+  char ioopt[128];
   
   /* Initialize defaults */
   __myfs_options.filename = NULL;
   __myfs_options.size = NULL;
+  __myfs_options.statslog = NULL;
+  __myfs_options.trace = NULL;
+  __myfs_options.tracesize = NULL;
+  __myfs_options.writeback = NULL;
+  __myfs_options.defrag = NULL;
+  __myfs_options.cache = NULL;
+  __myfs_options.iosize = NULL;
+  __myfs_options.workload = NULL;
+  __myfs_options.hugepages = NULL;
+  __myfs_options.workers = NULL;
+  __myfs_options.cpus = NULL;
+  __myfs_options.wbcache = 0;
+  __myfs_options.prefault = 0;
+  __myfs_options.lowlevel = 0;
   __myfs_options.show_help = 0;
         
   /* Parse options */
@@ -687,6 +3111,20 @@ int main(int argc, char *argv[]) {
     env_ptr = &__myfs_environment;
     if (!__myfs_setup_environment(env_ptr, &__myfs_options))
       return 1;
+    /* SIGUSR1 is only taken by the stats thread, so block it
+       before FUSE starts any thread that could inherit it */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    snprintf(ioopt, sizeof(ioopt), "-obig_writes,async_read,max_write=%zu,max_read=%zu,max_readahead=%zu",
+             env_ptr->io_size, env_ptr->io_size, env_ptr->io_size);
+    assert(fuse_opt_add_arg(&args, ioopt) == 0);
+    /* The low-level frontend hands out the timeouts itself */
+    if (__myfs_options.lowlevel)
+      return __myfs_ll_main(&args, env_ptr);
+    snprintf(cacheopt, sizeof(cacheopt), "-oattr_timeout=%zu,entry_timeout=%zu",
+             env_ptr->cache_timeout, env_ptr->cache_timeout);
+    assert(fuse_opt_add_arg(&args, cacheopt) == 0);
   } else {
     /* Handle displaying of help text */
     __myfs_show_help(argv[0]);
@@ -694,5 +3132,7 @@ int main(int argc, char *argv[]) {
     args.argv[0] = (char*) "";
   }
   
-  return fuse_main(args.argc, args.argv, &__myfs_operations, env_ptr);
+  if (env_ptr == NULL)
+    return fuse_main(args.argc, args.argv, &__myfs_operations, env_ptr);
+  return __myfs_hl_main(&args, env_ptr);
 }
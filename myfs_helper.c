@@ -5,23 +5,37 @@
 /*Helper Function Internals
 	blkalloc
 	blkfree
+	blkqueue
 	newnode
 	nodevalid
 	loadpos
 	advance
 	seek
+	nodegoal
 	frealloc
-	namepathset
-	namepatheq
+	fextend
+	fpalloc
+	fpunch
+	ftrim
+	fstrim
+	forphan
+	freclaim
+	frecover
+	fdefrag
+	fileio
+	namelen
+	namehash
+	nameeq
+	nameset
 	dirmod
 	path2node
+	fscheck
 	fsinit
 */
 
 /*TODO:
 	better errno use/review internal error cases
 	modify dirmod to use fpos struct
-	proper/efficient read, write, frealloc
 */
 /*post-advancement conditions
 	empty file
@@ -60,33 +74,105 @@
 */
 
 #include "myfs_helper.h"
+#include "myfs_stats.h"
+#include "myfs_probes.h"
+#include <pthread.h>
 
-sz_blk blkalloc(void *fsptr, sz_blk count, blkset *buf)
+//name scans use the widest vectors the build targets, compiled with -mavx2 or -march=native they are 32 bytes
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VEC_SIZE	32
+#define VEC_ALL		0xffffffffu
+typedef __m256i vec;
+#define VLOAD(p)	_mm256_load_si256((const vec*)(p))
+#define VLOADU(p)	_mm256_loadu_si256((const vec*)(p))
+#define VSET(c)		_mm256_set1_epi8(c)
+#define VEQ(a,b)	_mm256_cmpeq_epi8(a,b)
+#define VOR(a,b)	_mm256_or_si256(a,b)
+#define VMASK(v)	(uint32_t)_mm256_movemask_epi8(v)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VEC_SIZE	16
+#define VEC_ALL		0xffffu
+typedef __m128i vec;
+#define VLOAD(p)	_mm_load_si128((const vec*)(p))
+#define VLOADU(p)	_mm_loadu_si128((const vec*)(p))
+#define VSET(c)		_mm_set1_epi8(c)
+#define VEQ(a,b)	_mm_cmpeq_epi8(a,b)
+#define VOR(a,b)	_mm_or_si128(a,b)
+#define VMASK(v)	(uint32_t)_mm_movemask_epi8(v)
+#endif
+
+//the negative cache remembers lookups that found nothing, a slot per directory and name hash, the name is kept
+//so a hash collision cannot answer for a name that exists, names longer than NEG_NAME are not cached
+//it is the one exception to keeping no state outside the image: it only ever answers what a scan would, and is
+//shared by every image in the process, so each slot is tagged with the fsptr of its image and all of it is
+//guarded by neglock, whatever lock the caller holds, fscheck and fsinit empty it so an image mapped where another
+//was, or formatted over one, never sees the slots of the one before
+#define NEG_SLOTS	4096
+#define NEG_NAME	(48-sizeof(nodei))
+typedef struct{
+	void *fs;
+	nodei dir;
+	uint32_t hash;
+	uint32_t len;
+	char name[NEG_NAME];
+} negentry;
+_Static_assert(sizeof(negentry)==64,"negentry does not fill its cache line");
+static negentry negcache[NEG_SLOTS];
+static pthread_mutex_t neglock=PTHREAD_MUTEX_INITIALIZER;
+
+static sz_blk regtake(void *fsptr, blkset *link, blkset start, sz_blk count, blkset *buf, int mode)
+{
+	blkset reg=*link;
+	freereg fhead=*(freereg*)B2P(reg);
+	sz_blk took=MIN(count,reg+fhead.size-start), i;
+	
+	for(i=0;i<took;i++) buf[i]=start+i;
+	if(start+took<reg+fhead.size){
+		freereg *rest=(freereg*)B2P(start+took);
+		rest->size=reg+fhead.size-start-took;
+		rest->next=fhead.next;
+		fhead.next=start+took;
+	}if(start==reg) *link=fhead.next;
+	else{
+		freereg *head=(freereg*)B2P(reg);
+		head->size=start-reg;
+		head->next=fhead.next;
+	}if(mode==ALLOC_ZERO) memset(B2P(start),0,took*BLKSZ);
+	return took;
+}
+sz_blk blkalloc(void *fsptr, sz_blk count, blkset *buf, int mode, blkset goal)
 {
+	STAT_SCOPE(ST_BLKALLOC);
 	fsheader *fshead=fsptr;
-	blkset freeoff=fshead->freelist;
-	freereg *prev=NULL;
+	blkset *link, *pick=NULL, *wrap=NULL;
 	sz_blk alloct=0;
+	size_t regions=0;
 	
-	while(alloct<count && freeoff!=NULLOFF){
-		freereg fhead=*(freereg*)B2P(freeoff);
-		sz_blk freeblk=0;
-		while(freeblk<(fhead.size) && alloct<count){
-			buf[alloct++]=freeoff+freeblk++;
-		}memset(B2P(freeoff),0,freeblk*BLKSZ);
-		if(freeblk==(fhead.size)){
-			freeoff=fhead.next;
-			if(prev!=NULL) prev->next=fhead.next;
-			else fshead->freelist=fhead.next;
-		}else{
-			fhead.size-=freeblk;
-			freeoff+=freeblk;
-			if(prev!=NULL) prev->next=freeoff;
-			else fshead->freelist=freeoff;
-			prev=(freereg*)B2P(freeoff);
-			*prev=fhead;
+	//the free list is sorted, so one pass finds the region holding goal or the first one past it that fits
+	if(goal!=NULLOFF && count>0){
+		for(link=&(fshead->freelist);*link!=NULLOFF;link=&(((freereg*)B2P(*link))->next)){
+			freereg *fhead=(freereg*)B2P(*link);
+			if(*link+fhead->size<=goal){
+				if(wrap==NULL && fhead->size>=count) wrap=link;
+			}else if(*link<=goal){
+				alloct=regtake(fsptr,link,goal,count,buf,mode);
+				regions++;
+				break;
+			}else if(fhead->size>=count){
+				pick=link;
+				break;
+			}
+		}if(alloct==0 && (pick!=NULL || (pick=wrap)!=NULL)){
+			alloct=regtake(fsptr,pick,*pick,count,buf,mode);
+			regions++;
 		}
+	}while(alloct<count && fshead->freelist!=NULLOFF){
+		alloct+=regtake(fsptr,&(fshead->freelist),fshead->freelist,count-alloct,buf+alloct,mode);
+		regions++;
 	}fshead->free-=alloct;
+	MYFS_PROBE3(blkalloc,count,alloct,regions);
 	return alloct;
 }
 
@@ -107,8 +193,12 @@ void filter(blkset *heap, size_t dex, size_t len)
 }
 void offsort(blkset *data,size_t len)
 {
-	size_t i=len;
+	size_t i=1;
 	
+	//blocks freed from a map mostly come in order already
+	while(i<len && data[i-1]<=data[i]) i++;
+	if(i>=len) return;
+	i=len;
 	while(i) filter(data,--i,len);
 	while(len){
 		swap(data,&data[--len]);
@@ -117,16 +207,19 @@ void offsort(blkset *data,size_t len)
 }
 sz_blk blkfree(void *fsptr, sz_blk count, blkset *buf)
 {
+	STAT_SCOPE(ST_BLKFREE);
 	fsheader *fshead=fsptr;
 	blkset freeoff=fshead->freelist;
 	freereg *fhead;
-	sz_blk freect=0;
+	sz_blk freect=0, request=count;
+	size_t regions=0;
 	
 	offsort(buf,count);
 	while(freect<count && *buf<(fshead->ntsize)){
 		*(buf++)=NULLOFF; count--;
 	}if(freect<count && ((freeoff==NULLOFF && *buf<fshead->size) || *buf<freeoff)){
 		fhead=(freereg*)B2P(freeoff=*buf);
+		regions++;
 		fhead->next=fshead->freelist;
 		fshead->freelist=freeoff;
 		if((freeoff+(fhead->size=1))==fhead->next){
@@ -139,11 +232,13 @@ sz_blk blkfree(void *fsptr, sz_blk count, blkset *buf)
 		if(buf[freect]>=(freeoff+fhead->size)){
 			if(fhead->next!=NULLOFF && buf[freect]>=fhead->next){
 				freeoff=fhead->next;
+				regions++;
 				continue;
 			}if(buf[freect]==(freeoff+fhead->size)){
 				fhead->size++;
 			}else{
 				freereg *tmp=B2P(freeoff=buf[freect]);
+				regions++;
 				tmp->next=fhead->next;
 				tmp->size=1;
 				fhead->next=freeoff;
@@ -159,17 +254,32 @@ sz_blk blkfree(void *fsptr, sz_blk count, blkset *buf)
 	}while(freect<count){
 		(buf++)[freect]=NULLOFF; count--;
 	}fshead->free+=freect;
+	MYFS_PROBE3(blkfree,request,freect,regions);
 	return freect;
 }
 
+sz_blk blkqueue(void *fsptr, blkset *batch, sz_blk *ct, blkset *buf, sz_blk count)
+{
+	sz_blk freed=0, k;
+	
+	for(k=0;k<count;k++){
+		if(*ct==FREE_BATCH){
+			freed+=blkfree(fsptr,*ct,batch);
+			*ct=0;
+		}batch[(*ct)++]=buf[k];
+		buf[k]=NULLOFF;
+	}return freed;
+}
+
 nodei newnode(void *fsptr)
 {
 	fsheader *fshead=fsptr;
 	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
 	size_t nodect=fshead->ntsize*NODES_BLOCK-1;
 	nodei i=0;
 	while(++i<nodect){
-		if(nodetbl[i].nlinks==0 && nodetbl[i].blocks[0]==NULLOFF) return i;
+		if(nodetbl[i].nlinks==0 && maptbl[i].blocks[0]==NULLOFF && !(nodetbl[i].flags&NODE_OPEN)) return i;
 	}return NONODE;
 }
 
@@ -186,7 +296,7 @@ int nodevalid(void *fsptr, nodei node)
 void loadpos(void *fsptr, fpos *pos, nodei node)
 {
 	fsheader *fshead=fsptr;
-	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
 	
 	if(pos==NULL) return;
 	if(nodevalid(fsptr,node)<NODEI_GOOD){
@@ -197,7 +307,7 @@ void loadpos(void *fsptr, fpos *pos, nodei node)
 	pos->opos=0;
 	pos->dpos=0;
 	pos->oblk=NULLOFF;
-	pos->dblk=nodetbl[node].blocks[0];
+	pos->dblk=maptbl[node].blocks[0];
 	pos->data=pos->dblk*BLKSZ;
 }
 
@@ -205,6 +315,7 @@ sz_blk advance(void *fsptr, fpos *pos, sz_blk blks)
 {
 	fsheader *fshead=fsptr;
 	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
 	sz_blk adv=0;
 	size_t unit=1;
 	
@@ -214,30 +325,27 @@ sz_blk advance(void *fsptr, fpos *pos, sz_blk blks)
 	if(pos->data==NULLOFF){
 		if(pos->dpos*unit==BLKSZ) pos->opos--;
 	}pos->dpos=0;
-	while(blks){
-		blkdex opos=pos->opos+1;
-		if(pos->oblk==NULLOFF){
-			if(opos==OFFS_NODE){
-				if((pos->oblk=nodetbl[pos->node].blocklist)==NULLOFF) break;
-				offblock *offs=B2P(pos->oblk);
-				pos->dblk=offs->blocks[opos=0];
-			}else{
-				if(nodetbl[pos->node].blocks[opos]==NULLOFF) break;
-				pos->dblk=nodetbl[pos->node].blocks[opos];
-			}
+	//the block number alone gives the offblock and slot of the target, so only the offblocks in between are visited
+	adv=MIN(blks,maptbl[pos->node].nblocks-1-pos->nblk);
+	if(adv>0){
+		sz_blk idx=pos->nblk+adv, hops;
+		blkset oblk;
+		
+		if(idx<OFFS_NODE){
+			pos->opos=idx;
+			pos->dblk=maptbl[pos->node].blocks[idx];
 		}else{
-			offblock *offs=B2P(pos->oblk);
-			if(opos==OFFS_BLOCK){
-				if(offs->next==NULLOFF) break;
-				pos->oblk=offs->next;
-				offs=(offblock*)B2P(pos->oblk);
-				pos->dblk=offs->blocks[opos=0];
+			if(pos->oblk==NULLOFF){
+				oblk=maptbl[pos->node].blocklist;
+				hops=(idx-OFFS_NODE)/OFFS_BLOCK;
 			}else{
-				if(offs->blocks[opos]==NULLOFF) break;
-				pos->dblk=offs->blocks[opos];
-			}
-		}pos->opos=opos;
-		adv++; blks--;
+				oblk=pos->oblk;
+				hops=(idx-OFFS_NODE)/OFFS_BLOCK-(pos->nblk-OFFS_NODE)/OFFS_BLOCK;
+			}for(;hops>0;hops--) oblk=((offblock*)B2P(oblk))->next;
+			pos->oblk=oblk;
+			pos->opos=(idx-OFFS_NODE)%OFFS_BLOCK;
+			pos->dblk=((offblock*)B2P(oblk))->blocks[pos->opos];
+		}
 	}pos->data=pos->dblk*BLKSZ;
 	pos->nblk+=adv;
 	return adv;
@@ -245,6 +353,7 @@ sz_blk advance(void *fsptr, fpos *pos, sz_blk blks)
 
 size_t seek(void *fsptr, fpos *pos, size_t off)
 {
+	STAT_SCOPE(ST_SEEK);
 	fsheader *fshead=fsptr;
 	inode *nodetbl=O2P(fshead->nodetbl);
 	size_t adv=0, bck=0, unit=1;
@@ -271,157 +380,661 @@ size_t seek(void *fsptr, fpos *pos, size_t off)
 	}return (adv-bck);
 }
 
-int frealloc(void *fsptr, nodei node, size_t size)
+blkset nodegoal(void *fsptr, nodei node)
+{
+	fsheader *fshead=fsptr;
+	nodemap *maptbl=NODEMAP(fshead);
+	blkset oblk;
+	sz_blk n, k;
+	
+	if(nodevalid(fsptr,node)<NODEI_GOOD || (n=maptbl[node].nblocks)==0) return NULLOFF;
+	if(n<=OFFS_NODE) return maptbl[node].blocks[n-1]+1;
+	for(oblk=maptbl[node].blocklist,k=(n-1-OFFS_NODE)/OFFS_BLOCK;k>0;k--) oblk=((offblock*)B2P(oblk))->next;
+	return ((offblock*)B2P(oblk))->blocks[(n-1-OFFS_NODE)%OFFS_BLOCK]+1;
+}
+
+//blocks held past what the size needs, the reserved count of the header is the sum of this over all files,
+//so every change to nblocks, size or flags moves it by the difference
+static sz_blk spare(inode *nd, nodemap *nm)
+{
+	sz_blk need=CLDIV(nd->size,BLKSZ);
+	return ((nd->flags&(NODE_KEEP|NODE_ORPHAN)) || nm->nblocks<=need)?0:nm->nblocks-need;
+}
+//next block of a grow, allocated FREE_BATCH at a time from where the last batch ended, left counts what the
+//grow still needs so no batch takes more
+static blkset blkpop(void *fsptr, blkbatch *bat)
+{
+	if(bat->next==bat->have){
+		bat->have=blkalloc(fsptr,MIN(bat->left,FREE_BATCH),bat->blks,ALLOC_RAW,bat->goal);
+		bat->left-=bat->have;
+		bat->next=0;
+		bat->goal=bat->blks[bat->have-1]+1;
+	}return bat->blks[bat->next++];
+}
+static void setkeep(void *fsptr, nodei node, int keep)
+{
+	fsheader *fshead=fsptr;
+	inode *nd=(inode*)O2P(fshead->nodetbl)+node;
+	nodemap *nm=NODEMAP(fshead)+node;
+	sz_blk old=spare(nd,nm);
+	
+	nd->flags=(keep)?(nd->flags|NODE_KEEP):(nd->flags&~NODE_KEEP);
+	fshead->reserved+=spare(nd,nm)-old;
+}
+
+static int fresize(void *fsptr, nodei node, sz_blk blksize, blkset goal)
 {
 	fsheader *fshead=fsptr;
 	inode *nodetbl=O2P(fshead->nodetbl);
-	fpos pos;
+	nodemap *maptbl=NODEMAP(fshead);
+	sz_blk old=spare(&nodetbl[node],&maptbl[node]);
 	ssize_t blkdiff;
-	sz_blk blksize;
 	
-	loadpos(fsptr,&pos,node);
-	if(pos.node==NONODE || nodetbl[pos.node].mode==DIRMODE) return -1;
-	
-	blksize=CLDIV(size,BLKSZ);
-	blkdiff=blksize-nodetbl[node].nblocks;
+	blkdiff=(ssize_t)blksize-(ssize_t)maptbl[node].nblocks;
 	if(blkdiff<0){
-		sz_blk fct=0,adv=0;
+		sz_blk idx=blksize, oldblks=maptbl[node].nblocks, first=OFFS_NODE, run, ct=0;
+		blkset oblk=maptbl[node].blocklist, next, *link=&(maptbl[node].blocklist), batch[FREE_BATCH];
 		offblock *offs;
-		if(blksize<=OFFS_NODE){
-			fct=OFFS_NODE-blksize;
-			advance(fsptr,&pos,blksize);
-			if(fct!=0){
-				adv=advance(fsptr,&pos,fct);
-				blkfree(fsptr,fct,&(nodetbl[node].blocks[blksize]));
-			}blkfree(fsptr,1,&(nodetbl[node].blocklist));
-		}else{
-			advance(fsptr,&pos,blksize-1);
-			offs=(offblock*)B2P(pos.oblk);
-			advance(fsptr,&pos,1);
-			if(pos.opos>0){
-				fct=OFFS_BLOCK-pos.opos;
-				adv=advance(fsptr,&pos,fct);
-				blkfree(fsptr,fct,&(offs->blocks[OFFS_BLOCK-fct]));
-			}offs->next=NULLOFF;
-		}while(adv==fct){
-			offs=(offblock*)B2P(pos.oblk);
-			blkset prev=pos.oblk;
-			fct=OFFS_BLOCK;
-			adv=advance(fsptr,&pos,fct);
-			blkfree(fsptr,fct,offs->blocks);
-			blkfree(fsptr,1,&prev);
-		}
-	}else if(size>nodetbl[node].size){
-		seek(fsptr,&pos,nodetbl[node].size);
-		if(pos.dblk!=NULLOFF && pos.dpos<BLKSZ){
-			memset(O2P(pos.dblk*BLKSZ+pos.dpos),0,BLKSZ-pos.dpos);
-			pos.opos++;
-		}if(blkdiff>0){
-			offblock *offs;
-			blkset *tblks;
-			sz_blk noblks,alloct;
-			
-			if(pos.oblk==NULLOFF){
-				noblks=(blkdiff+pos.opos+(OFFS_BLOCK-OFFS_NODE)-1)/OFFS_BLOCK;
+		
+		if(idx<OFFS_NODE){
+			run=MIN(oldblks,OFFS_NODE)-idx;
+			blkqueue(fsptr,batch,&ct,&(maptbl[node].blocks[idx]),run);
+			idx+=run;
+		}//the walk only follows next up to the offblock holding the new end, the offblocks past it are each read
+		//once and queued after their next is read, once the chain is cut link is NULL
+		if(idx<oldblks && idx>OFFS_NODE){
+			for(run=(idx-OFFS_NODE)/OFFS_BLOCK;run>0;run--){
+				link=&(((offblock*)B2P(oblk))->next);
+				oblk=*link;
+			}first+=(idx-OFFS_NODE)/OFFS_BLOCK*OFFS_BLOCK;
+		}while(idx<oldblks){
+			offs=(offblock*)B2P(oblk);
+			next=offs->next;
+			run=MIN(oldblks,first+OFFS_BLOCK)-idx;
+			//an offblock sits just before the run it maps, queued in that order the batch needs no sorting,
+			//room is made for both so the offblock is not freed while its slots are still being read
+			if(idx==first){
+				if(link!=NULL) *link=NULLOFF;
+				if(ct+1+run>FREE_BATCH){
+					blkfree(fsptr,ct,batch);
+					ct=0;
+				}blkqueue(fsptr,batch,&ct,&oblk,1);
+			}else offs->next=NULLOFF;
+			blkqueue(fsptr,batch,&ct,&(offs->blocks[idx-first]),run);
+			link=NULL;
+			idx+=run;
+			oblk=next;
+			first+=OFFS_BLOCK;
+		}blkfree(fsptr,ct,batch);
+	}else if(blkdiff>0){
+		sz_blk idx=maptbl[node].nblocks, run, k;
+		offblock *offs=NULL;
+		blkset *slot;
+		blkbatch bat;
+		
+		//take nothing unless everything fits, then no blkalloc below can come up short
+		bat.left=blkdiff+MAPBLKS(blksize)-MAPBLKS(idx);
+		if(bat.left>fshead->free) return -1;
+		if(idx>OFFS_NODE){
+			blkset oblk=maptbl[node].blocklist;
+			for(run=(idx-1-OFFS_NODE)/OFFS_BLOCK;run>0;run--) oblk=((offblock*)B2P(oblk))->next;
+			offs=(offblock*)B2P(oblk);
+			goal=offs->blocks[(idx-1-OFFS_NODE)%OFFS_BLOCK]+1;
+		}else if(idx>0) goal=maptbl[node].blocks[idx-1]+1;
+		bat.goal=goal;
+		bat.next=bat.have=0;
+		//blocks come in order from batches that each continue the last, an offblock just before the run it maps
+		while(idx<blksize){
+			if(idx<OFFS_NODE){
+				slot=&(maptbl[node].blocks[idx]);
+				run=MIN(blksize,OFFS_NODE)-idx;
 			}else{
-				noblks=(blkdiff+pos.opos-1)/OFFS_BLOCK;
-			}
-			
-			if((tblks=(blkset*)malloc((blkdiff+noblks)*sizeof(blkset)))==NULL) return -1;
-			if(blkalloc(fsptr,blkdiff+noblks,tblks)<(blkdiff+noblks)){
-				blkfree(fsptr,blkdiff+noblks,tblks);
-				free(tblks);
-				return -1;
-			}
-			
-			nodetbl[node].size=nodetbl[node].nblocks*BLKSZ;
-			seek(fsptr,&pos,BLKSZ);
-			alloct=0;
-			while(alloct<(noblks+blkdiff)){
-				if(pos.oblk==NULLOFF){
-					if(pos.opos==OFFS_NODE){
-						nodetbl[node].blocklist=tblks[alloct++];
-						offs=(offblock*)B2P(nodetbl[node].blocklist);
-						pos.opos=0; pos.oblk=nodetbl[node].blocklist;
-						offs->blocks[0]=tblks[alloct];
-					}else{
-						nodetbl[node].blocks[pos.opos]=tblks[alloct];
-					}
-				}else{
-					offs=(offblock*)B2P(pos.oblk);
-					if(pos.opos==OFFS_BLOCK){
-						offs->next=tblks[alloct++];
-						pos.oblk=offs->next;
-						offs=(offblock*)B2P(offs->next);
-						pos.opos=0;
-					}offs->blocks[pos.opos]=tblks[alloct];
-				}alloct++;
-				nodetbl[node].size+=BLKSZ;
-				nodetbl[node].nblocks++;
-				pos.opos++;
-			}free(tblks);
+				blkdex opos=(idx-OFFS_NODE)%OFFS_BLOCK;
+				if(opos==0){
+					blkset oblk=blkpop(fsptr,&bat);
+					memset(B2P(oblk),0,BLKSZ);
+					if(offs==NULL) maptbl[node].blocklist=oblk;
+					else offs->next=oblk;
+					offs=(offblock*)B2P(oblk);
+				}slot=&(offs->blocks[opos]);
+				run=MIN(blksize-idx,OFFS_BLOCK-opos);
+			}for(k=0;k<run;k++) slot[k]=blkpop(fsptr,&bat);
+			idx+=run;
 		}
-	}nodetbl[node].nblocks=blksize;
+	}MYFS_PROBE3(frealloc,node,blksize-blkdiff,blksize);
+	maptbl[node].nblocks=blksize;
+	fshead->reserved+=spare(&nodetbl[node],&maptbl[node])-old;
+	return 0;
+}
+static void setsize(void *fsptr, nodei node, size_t size)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	sz_blk old=spare(&nodetbl[node],&maptbl[node]);
+	
 	nodetbl[node].size=size;
+	fshead->reserved+=spare(&nodetbl[node],&maptbl[node])-old;
+	if(maptbl[node].vsize>size) maptbl[node].vsize=size;
+}
+
+int frealloc(void *fsptr, nodei node, size_t size, blkset goal)
+{
+	STAT_SCOPE(ST_FREALLOC);
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	sz_blk blksize=CLDIV(size,BLKSZ);
+	
+	if(nodevalid(fsptr,node)<NODEI_GOOD || nodetbl[node].mode==DIRMODE) return -1;
+	//growing within preallocated blocks keeps them, anything else drops them with the rest
+	if((nodetbl[node].flags&NODE_KEEP) && size>nodetbl[node].size && blksize<maptbl[node].nblocks){
+		blksize=maptbl[node].nblocks;
+	}else setkeep(fsptr,node,0);
+	if(fresize(fsptr,node,blksize,goal)==-1){
+		if(fstrim(fsptr)==0 || fresize(fsptr,node,blksize,goal)==-1) return -1;
+	}setsize(fsptr,node,size);
 	return 0;
 }
 
-void namepathset(char *name, const char *path)
+int fextend(void *fsptr, nodei node, size_t size, blkset goal)
 {
-	size_t len=0;
-	if(name==path) return;
-	while(path[len]!='/' && path[len]!='\0'){
-		name[len]=path[len];
-		if(++len==NAMELEN-1) break;
-	}name[len]='\0';
+	STAT_SCOPE(ST_FREALLOC);
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	sz_blk need=CLDIV(size,BLKSZ), extra;
+	
+	if(nodevalid(fsptr,node)<NODEI_GOOD || nodetbl[node].mode==DIRMODE || size<nodetbl[node].size) return -1;
+	if(need>maptbl[node].nblocks){
+		setkeep(fsptr,node,0);
+		extra=(need<PREALLOC_MIN)?PREALLOC_MIN:MIN(need,PREALLOC_MAX);
+		if(extra>fshead->free/PREALLOC_SHARE) extra=fshead->free/PREALLOC_SHARE;
+		if((extra==0 || fresize(fsptr,node,need+extra,goal)==-1) && fresize(fsptr,node,need,goal)==-1){
+			if(fstrim(fsptr)==0 || fresize(fsptr,node,need,goal)==-1) return -1;
+		}
+	}setsize(fsptr,node,size);
+	return 0;
+}
+
+int fpalloc(void *fsptr, nodei node, size_t off, size_t len, int keep, blkset goal)
+{
+	STAT_SCOPE(ST_FREALLOC);
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	size_t end=off+len, mapped;
+	sz_blk blksize=CLDIV(end,BLKSZ);
+	
+	if(nodevalid(fsptr,node)<NODEI_GOOD || nodetbl[node].mode!=FILEMODE) return -1;
+	//holes in the part already mapped get blocks, the rest is mapped in runs as long as the allocator has them
+	mapped=MIN(end,maptbl[node].nblocks*BLKSZ);
+	if(off<mapped && fileio(fsptr,node,off,NULL,mapped-off,IO_FILL)<mapped-off) return -1;
+	if(blksize>maptbl[node].nblocks && fresize(fsptr,node,blksize,goal)==-1){
+		if(fstrim(fsptr)==0 || fresize(fsptr,node,blksize,goal)==-1) return -1;
+	}if(keep) setkeep(fsptr,node,1);
+	else if(end>nodetbl[node].size) setsize(fsptr,node,end);
+	return 0;
+}
+
+int fpunch(void *fsptr, nodei node, size_t off, size_t len)
+{
+	STAT_SCOPE(ST_FREALLOC);
+	fsheader *fshead=fsptr;
+	inode *nd=(inode*)O2P(fshead->nodetbl)+node;
+	nodemap *nm=NODEMAP(fshead)+node;
+	size_t end=off+len;
+	sz_blk idx, last, run, k, ct=0;
+	offblock *offs=NULL;
+	blkset *slot, batch[FREE_BATCH];
+	
+	if(nodevalid(fsptr,node)<NODEI_GOOD || nd->mode!=FILEMODE) return -1;
+	if(end>nm->nblocks*BLKSZ) end=nm->nblocks*BLKSZ;
+	if(off>=end) return 0;
+	//nothing valid past the range means nothing in it needs zeroing, otherwise only the partial blocks at its edges do
+	if(end>=nm->vsize){
+		if(off<nm->vsize) nm->vsize=off;
+	}else{
+		size_t head=MIN(CLDIV(off,BLKSZ)*BLKSZ,end);
+		fileio(fsptr,node,off,NULL,head-off,IO_ZERO);
+		if(end/BLKSZ*BLKSZ>=head) fileio(fsptr,node,end/BLKSZ*BLKSZ,NULL,end%BLKSZ,IO_ZERO);
+	}idx=CLDIV(off,BLKSZ);
+	last=end/BLKSZ;
+	if(idx>=last) return 0;
+	//whole blocks at the end of the map past the size are dropped, the rest become holes
+	if(last==nm->nblocks && idx>=CLDIV(nd->size,BLKSZ)) return fresize(fsptr,node,idx,NULLOFF);
+	for(;idx<last;idx+=run){
+		if(idx<OFFS_NODE){
+			slot=&(nm->blocks[idx]);
+			run=MIN(last,OFFS_NODE)-idx;
+		}else{
+			if(offs==NULL){
+				blkset oblk=nm->blocklist;
+				for(k=(idx-OFFS_NODE)/OFFS_BLOCK;k>0;k--) oblk=((offblock*)B2P(oblk))->next;
+				offs=(offblock*)B2P(oblk);
+			}else offs=(offblock*)B2P(offs->next);
+			slot=&(offs->blocks[(idx-OFFS_NODE)%OFFS_BLOCK]);
+			run=MIN(last-idx,OFFS_BLOCK-(idx-OFFS_NODE)%OFFS_BLOCK);
+		}blkqueue(fsptr,batch,&ct,slot,run);
+		for(k=0;k<run;k++) slot[k]=HOLE;
+	}blkfree(fsptr,ct,batch);
+	return 0;
+}
+
+sz_blk ftrim(void *fsptr, nodei node)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	sz_blk need, resv;
+	
+	if(nodevalid(fsptr,node)<NODEI_GOOD || nodetbl[node].mode!=FILEMODE || (nodetbl[node].flags&(NODE_KEEP|NODE_ORPHAN))) return 0;
+	need=CLDIV(nodetbl[node].size,BLKSZ);
+	if(maptbl[node].nblocks<=need) return 0;
+	resv=maptbl[node].nblocks-need;
+	fresize(fsptr,node,need,NULLOFF);
+	return resv;
+}
+
+sz_blk fstrim(void *fsptr)
+{
+	fsheader *fshead=fsptr;
+	size_t nodect=fshead->ntsize*NODES_BLOCK-1;
+	sz_blk freed=0;
+	nodei i;
+	
+	for(i=1;i<nodect && fshead->reserved>0;i++) freed+=ftrim(fsptr,i);
+	return freed+freclaim(fsptr,fshead->size);
+}
+sz_blk forphan(void *fsptr, nodei node, size_t size)
+{
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl), *nd=&nodetbl[node];
+	nodemap *maptbl=NODEMAP(fshead), *nm=&maptbl[node];
+	sz_blk need=CLDIV(size,BLKSZ), cut, old, k;
+	blkset *link;
+	nodei tail;
+	
+	if(nodevalid(fsptr,node)<NODEI_GOOD || nd->mode!=FILEMODE || (nd->flags&NODE_ORPHAN)) return 0;
+	if(nm->nblocks<need+ORPHAN_MIN) return 0;
+	if(nd->nlinks==0){
+		setkeep(fsptr,node,0);
+		old=spare(nd,nm);
+		nd->flags|=NODE_ORPHAN;
+		nd->size=0;
+		fshead->reserved-=old;
+		nm->next=fshead->orphans;
+		fshead->orphans=node;
+		return nm->nblocks;
+	}//the tail starts at the first offblock mapping nothing below need, the file keeps the rest for frealloc to trim
+	cut=(need<=OFFS_NODE)?0:CLDIV(need-OFFS_NODE,OFFS_BLOCK);
+	if(nm->nblocks<=OFFS_NODE+cut*OFFS_BLOCK || (tail=newnode(fsptr))==NONODE) return 0;
+	for(link=&(nm->blocklist),k=cut;k>0;k--) link=&(((offblock*)B2P(*link))->next);
+	old=spare(nd,nm);
+	nodetbl[tail].mode=FILEMODE;
+	nodetbl[tail].flags=NODE_ORPHAN;
+	nodetbl[tail].size=0;
+	for(k=0;k<OFFS_NODE;k++) maptbl[tail].blocks[k]=HOLE;
+	maptbl[tail].blocklist=*link;
+	maptbl[tail].nblocks=OFFS_NODE+nm->nblocks-(OFFS_NODE+cut*OFFS_BLOCK);
+	*link=NULLOFF;
+	nm->nblocks=OFFS_NODE+cut*OFFS_BLOCK;
+	fshead->reserved+=spare(nd,nm)-old;
+	maptbl[tail].next=fshead->orphans;
+	fshead->orphans=tail;
+	return maptbl[tail].nblocks-OFFS_NODE;
+}
+sz_blk freclaim(void *fsptr, sz_blk maxblks)
+{
+	STAT_SCOPE(ST_RECLAIM);
+	fsheader *fshead=fsptr;
+	inode *nd;
+	nodemap *nm;
+	blkset batch[FREE_BATCH], oblk;
+	sz_blk freed=0, left, ct=0;
+	nodei node;
+	
+	while(freed+ct<maxblks && (node=fshead->orphans)!=0){
+		nd=(inode*)O2P(fshead->nodetbl)+node;
+		nm=NODEMAP(fshead)+node;
+		//an offblock that is full and not the last comes off the front of the chain, the map is cut before its
+		//blocks are freed so it never names a free block, the slots behind it only move up
+		while(freed+ct<maxblks && nm->nblocks>OFFS_NODE+OFFS_BLOCK){
+			offblock *offs=(offblock*)B2P(oblk=nm->blocklist);
+			nm->blocklist=offs->next;
+			nm->nblocks-=OFFS_BLOCK;
+			if(ct+1+OFFS_BLOCK>FREE_BATCH){
+				freed+=blkfree(fsptr,ct,batch);
+				ct=0;
+			}blkqueue(fsptr,batch,&ct,&oblk,1);
+			blkqueue(fsptr,batch,&ct,offs->blocks,OFFS_BLOCK);
+		}freed+=blkfree(fsptr,ct,batch);
+		ct=0;
+		if(freed>=maxblks) break;
+		left=fshead->free;
+		fresize(fsptr,node,0,NULLOFF);
+		freed+=fshead->free-left;
+		fshead->orphans=nm->next;
+		nm->next=0;
+		nd->flags=0;
+	}return freed;
 }
-int namepatheq(char *name, const char *path)
+sz_blk frecover(void *fsptr)
 {
+	fsheader *fshead=fsptr;
+	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
+	size_t nodect=fshead->ntsize*NODES_BLOCK-1;
+	sz_blk found=0;
+	nodei i;
+	
+	for(i=1;i<nodect;i++){
+		if(nodetbl[i].nlinks==0) nodetbl[i].flags&=~NODE_OPEN;
+		if(nodetbl[i].nlinks>0 || maptbl[i].blocks[0]==NULLOFF || (nodetbl[i].flags&NODE_ORPHAN)) continue;
+		nodetbl[i].mode=FILEMODE;
+		nodetbl[i].flags=NODE_ORPHAN;
+		nodetbl[i].size=0;
+		maptbl[i].next=fshead->orphans;
+		fshead->orphans=i;
+		found++;
+	}return found;
+}
+
+//slot idx of the block map of node, *offs caches the offblock of slot idx-1, so walking the map in order costs
+//one step per offblock, *offs starts out NULL
+static blkset *mapslot(void *fsptr, nodei node, sz_blk idx, offblock **offs)
+{
+	fsheader *fshead=fsptr;
+	nodemap *nm=NODEMAP(fshead)+node;
+	blkset oblk;
+	sz_blk k;
+	
+	if(idx<OFFS_NODE) return &(nm->blocks[idx]);
+	if(*offs==NULL || (idx-OFFS_NODE)%OFFS_BLOCK==0){
+		if(*offs!=NULL) oblk=(*offs)->next;
+		else for(oblk=nm->blocklist,k=(idx-OFFS_NODE)/OFFS_BLOCK;k>0;k--) oblk=((offblock*)B2P(oblk))->next;
+		*offs=(offblock*)B2P(oblk);
+	}return &((*offs)->blocks[(idx-OFFS_NODE)%OFFS_BLOCK]);
+}
+
+//number of free blocks from start to the end of its free region, 0 if start is not free
+static sz_blk freerun(void *fsptr, blkset start)
+{
+	fsheader *fshead=fsptr;
+	blkset reg;
+	
+	for(reg=fshead->freelist;reg!=NULLOFF && reg<=start;reg=((freereg*)B2P(reg))->next){
+		if(start<reg+((freereg*)B2P(reg))->size) return reg+((freereg*)B2P(reg))->size-start;
+	}return 0;
+}
+
+//start of the smallest free region of at least count blocks, so the large ones stay large, or NULLOFF
+static blkset bestfit(void *fsptr, sz_blk count)
+{
+	fsheader *fshead=fsptr;
+	blkset reg, best=NULLOFF;
+	sz_blk size, bestsize=0;
+	
+	for(reg=fshead->freelist;reg!=NULLOFF;reg=((freereg*)B2P(reg))->next){
+		size=((freereg*)B2P(reg))->size;
+		if(size>=count && (best==NULLOFF || size<bestsize)){
+			best=reg;
+			bestsize=size;
+		}
+	}return best;
+}
+
+sz_blk fdefrag(void *fsptr, nodei node, sz_blk maxblks)
+{
+	STAT_SCOPE(ST_DEFRAG);
+	fsheader *fshead=fsptr;
+	inode *nd=(inode*)O2P(fshead->nodetbl)+node;
+	nodemap *nm=NODEMAP(fshead)+node;
+	blkset tmp[OFFS_BLOCK], first, goal, *slot;
+	offblock *offs=NULL;
+	sz_blk n, idx, prefix, done=0, run, k;
+	
+	if(nodevalid(fsptr,node)<NODEI_LINKD || nd->mode!=FILEMODE || (n=nm->nblocks)<2 || maxblks==0) return 0;
+	if((first=nm->blocks[0])==HOLE) return 0;
+	for(prefix=0,idx=1;idx<n;idx++){
+		blkset blk=*mapslot(fsptr,node,idx,&offs);
+		if(blk==HOLE) return 0;
+		if(prefix==0 && blk!=first+idx) prefix=idx;
+	}if(prefix==0) return 0;
+	if(freerun(fsptr,first+prefix)>=n-prefix) goal=first+prefix;
+	else if((goal=bestfit(fsptr,n))!=NULLOFF) prefix=0;
+	else return 0;
+	//each run is taken from the front of the free region, swapped into the map, and only then are the old blocks
+	//freed, so the map is valid between runs and the lock can be dropped there
+	offs=NULL;
+	for(idx=prefix;idx<n && done<maxblks;idx+=run,done+=run,goal+=run){
+		slot=mapslot(fsptr,node,idx,&offs);
+		run=(idx<OFFS_NODE)?OFFS_NODE-idx:OFFS_BLOCK-(idx-OFFS_NODE)%OFFS_BLOCK;
+		run=MIN(run,MIN(n-idx,maxblks-done));
+		k=blkalloc(fsptr,run,tmp,ALLOC_RAW,goal);
+		if(k<run || tmp[0]!=goal || tmp[run-1]!=goal+run-1){
+			blkfree(fsptr,k,tmp);
+			break;
+		}for(k=0;k<run;k++){
+			memcpy(B2P(tmp[k]),B2P(slot[k]),BLKSZ);
+			swap(&slot[k],&tmp[k]);
+		}blkfree(fsptr,run,tmp);
+	}return done;
+}
+
+size_t fruns(void *fsptr, nodei node, size_t off, size_t len, blkset *first, sz_blk *count, size_t max)
+{
+	fpos pos;
+	size_t runs=0;
+	sz_blk blks, k;
+	
+	loadpos(fsptr,&pos,node);
+	if(pos.node==NONODE || pos.dblk==NULLOFF || len==0 || max==0) return 0;
+	if(off/BLKSZ>0 && advance(fsptr,&pos,off/BLKSZ)<off/BLKSZ) return 0;
+	blks=(off+len-1)/BLKSZ-off/BLKSZ+1;
+	for(k=0;k<blks;k++){
+		if(pos.dblk!=HOLE){
+			if(runs>0 && first[runs-1]+count[runs-1]==pos.dblk) count[runs-1]++;
+			else if(runs==max) break;
+			else{
+				first[runs]=pos.dblk;
+				count[runs++]=1;
+			}
+		}if(k+1<blks && advance(fsptr,&pos,1)==0) break;
+	}return runs;
+}
+
+size_t fileio(void *fsptr, nodei node, size_t off, void *buf, size_t len, int mode)
+{
+	fsheader *fshead=fsptr;
+	nodemap *maptbl=NODEMAP(fshead);
+	fpos pos;
+	size_t done=0, dpos=off%BLKSZ, chunk;
+	blkset goal=NULLOFF, *slot;
+	sz_blk run, left;
+	
+	loadpos(fsptr,&pos,node);
+	if(pos.node==NONODE || pos.dblk==NULLOFF || len==0) return 0;
+	if(off/BLKSZ>0 && advance(fsptr,&pos,off/BLKSZ)<off/BLKSZ) return 0;
+	while(done<len){
+		chunk=MIN(len-done,BLKSZ-dpos);
+		run=1;
+		slot=(pos.oblk==NULLOFF)?&(maptbl[node].blocks[pos.opos]):&(((offblock*)B2P(pos.oblk))->blocks[pos.opos]);
+		//a hole given a block must read as zeros wherever it is not written now and may become valid
+		if(pos.dblk==HOLE && (mode==IO_WRITE || mode==IO_FILL)){
+			int zero=(mode==IO_WRITE)?(chunk<BLKSZ):(off+done-dpos<maptbl[node].vsize);
+			if(blkalloc(fsptr,1,slot,(zero)?ALLOC_ZERO:ALLOC_RAW,goal)==0) break;
+			pos.dblk=*slot;
+		}if(pos.dblk!=HOLE){
+			char *blk=(char*)B2P(pos.dblk)+dpos;
+			//the next slots of the same map array that are also the next blocks on disk join one copy
+			left=((pos.oblk==NULLOFF)?OFFS_NODE:OFFS_BLOCK)-pos.opos;
+			for(;run<left && chunk<len-done && slot[run]==pos.dblk+run;run++) chunk+=MIN(len-done-chunk,BLKSZ);
+			if(mode==IO_READ) memcpy((char*)buf+done,blk,chunk);
+			else if(mode==IO_WRITE) memcpy(blk,(const char*)buf+done,chunk);
+			else if(mode==IO_ZERO) memset(blk,0,chunk);
+			goal=pos.dblk+run;
+		}else if(mode==IO_READ) memset((char*)buf+done,0,chunk);
+		done+=chunk;
+		dpos=0;
+		if(done<len && advance(fsptr,&pos,run)<run) break;
+	}return done;
+}
+
+#ifdef VEC_SIZE
+__attribute__((no_sanitize_address))	//reads past the terminator, but only within its aligned vector, never into the next page
+#endif
+size_t namelen(const char *path)
+{
+#ifdef VEC_SIZE
+	//aligned loads never cross into the next page, the bytes before path in the first one are masked off
+	size_t skew=(uintptr_t)path%VEC_SIZE, off;
+	const char *blk=path-skew;
+	vec slash=VSET('/'), nul=VSET('\0'), x;
+	uint32_t keep=VEC_ALL<<skew, hits;
+	
+	for(off=0;;off+=VEC_SIZE){
+		x=VLOAD(blk+off);
+		if((hits=VMASK(VOR(VEQ(x,slash),VEQ(x,nul)))&keep)!=0) return off+__builtin_ctz(hits)-skew;
+		keep=VEC_ALL;
+	}
+#else
 	size_t len=0;
-	if(name==path) return 1;
-	while(path[len]!='/' && path[len]!='\0'){
-		if(name[len]=='\0' || name[len]!=path[len]) return 0;
-		if(++len==NAMELEN) return 1;
-	}return (name[len]=='\0');
+	while(path[len]!='/' && path[len]!='\0') len++;
+	return len;
+#endif
+}
+uint32_t namehash(const char *name, size_t len)
+{
+	uint32_t hash=2166136261u;
+	while(len-->0) hash=(hash^(unsigned char)*name++)*16777619u;
+	return hash;
+}
+int nameeq(const char *a, const char *b, size_t len)
+{
+#ifdef VEC_SIZE
+	for(;len>=VEC_SIZE;len-=VEC_SIZE,a+=VEC_SIZE,b+=VEC_SIZE){
+		if(VMASK(VEQ(VLOADU(a),VLOADU(b)))!=VEC_ALL) return 0;
+	}
+#endif
+	return memcmp(a,b,len)==0;
+}
+void nameset(direntry *ent, const char *path, size_t len, uint32_t hash)
+{
+	if(ent->name!=path) memcpy(ent->name,path,len);
+	ent->name[len]='\0';
+	ent->len=len;
+	ent->hash=hash;
+}
+//every name that appears in a directory comes through dirmod, which drops its slot, so a slot still holding it
+//is still true, removals need nothing as they only make more names missing
+static negentry *negslot(nodei dir, uint32_t hash)
+{
+	return &negcache[(hash^(uint32_t)dir*2654435761u)%NEG_SLOTS];
+}
+static int negmatch(negentry *neg, void *fsptr, nodei dir, const char *name, size_t len, uint32_t hash)
+{
+	return neg->fs==fsptr && neg->dir==dir && neg->hash==hash && neg->len==len && nameeq(neg->name,name,len);
+}
+static int negfind(void *fsptr, nodei dir, const char *name, size_t len, uint32_t hash)
+{
+	int hit;
+	pthread_mutex_lock(&neglock);
+	hit=negmatch(negslot(dir,hash),fsptr,dir,name,len,hash);
+	pthread_mutex_unlock(&neglock);
+	return hit;
+}
+static void negadd(void *fsptr, nodei dir, const char *name, size_t len, uint32_t hash)
+{
+	negentry *neg=negslot(dir,hash);
+	if(len>NEG_NAME) return;
+	pthread_mutex_lock(&neglock);
+	neg->fs=fsptr;
+	neg->dir=dir;
+	neg->hash=hash;
+	neg->len=len;
+	memcpy(neg->name,name,len);
+	pthread_mutex_unlock(&neglock);
+}
+static void negdrop(void *fsptr, nodei dir, const char *name, size_t len, uint32_t hash)
+{
+	negentry *neg=negslot(dir,hash);
+	pthread_mutex_lock(&neglock);
+	if(negmatch(neg,fsptr,dir,name,len,hash)) neg->fs=NULL;
+	pthread_mutex_unlock(&neglock);
+}
+static void negclear(void)
+{
+	pthread_mutex_lock(&neglock);
+	memset(negcache,0,sizeof(negcache));
+	pthread_mutex_unlock(&neglock);
+}
+//the hash and length reject almost every other entry before a byte of the name is read
+static int entryeq(direntry *ent, const char *name, size_t len, uint32_t hash)
+{
+	return ent->hash==hash && ent->len==len && nameeq(ent->name,name,len);
 }
 
 nodei dirmod(void *fsptr, nodei dir, const char *name, nodei node, const char *rename)
 {
+	STAT_SCOPE(ST_DIRMOD);
 	fsheader *fshead=fsptr;
 	inode *nodetbl=O2P(fshead->nodetbl);
+	nodemap *maptbl=NODEMAP(fshead);
 	blkset oblk=NULLOFF, prevo=NULLOFF;
-	blkset dblk=nodetbl[dir].blocks[0];
+	blkset dblk=maptbl[dir].blocks[0];
 	direntry *df, *found=NULL;
 	blkdex block=0, entry=0;
+	blkset last=NULLOFF;
+	size_t scanned=0, len, rlen=0;
+	uint32_t hash, rhash=0;
+	int mode=(rename==NULL)?((node==NONODE)?PROBE_LOOKUP:PROBE_ADD):((node==NONODE)?PROBE_RENAME:PROBE_REMOVE);
 	
 	if(nodevalid(fsptr,dir)<NODEI_LINKD || nodetbl[dir].mode!=DIRMODE) return NONODE;
 	if(node!=NONODE && rename==NULL && nodevalid(fsptr,node)<NODEI_GOOD) return NONODE;
 	if(*name=='\0' || (rename!=NULL && node==NONODE && *rename=='\0')) return NONODE;
+	if(node!=NONODE && rename==NULL && fshead->free<2 && (fshead->reserved>0 || fshead->orphans!=0)) fstrim(fsptr);
+	//names longer than an entry holds are cut short, the same way when stored and when looked up
+	len=MIN(namelen(name),NAMELEN-1);
+	hash=namehash(name,len);
+	if(rename!=NULL){
+		rlen=MIN(namelen(rename),NAMELEN-1);
+		rhash=namehash(rename,rlen);
+		if(node==NONODE) negdrop(fsptr,dir,rename,rlen,rhash);
+	}else if(node!=NONODE) negdrop(fsptr,dir,name,len,hash);
+	else if(negfind(fsptr,dir,name,len,hash)){
+		MYFS_PROBE3(dirmod,dir,PROBE_NEGHIT,0);
+		return NONODE;
+	}
 	
 	while(dblk!=NULLOFF){
 		df=(direntry*)B2P(dblk);
 		while(entry<FILES_DIR){
 			if(df[entry].node==NONODE) break;
-			if(node==NONODE && rename!=NULL && namepatheq(df[entry].name,rename)){
+			scanned++;
+			if(node==NONODE && rename!=NULL && entryeq(&df[entry],rename,rlen,rhash)){
+				MYFS_PROBE3(dirmod,dir,mode,scanned);
 				return NONODE;
-			}if(namepatheq(df[entry].name,name)){
+			}if(entryeq(&df[entry],name,len,hash)){
 				if(rename!=NULL) found=&df[entry];
 				else{
+					MYFS_PROBE3(dirmod,dir,mode,scanned);
 					if(node==NONODE) return df[entry].node;
 					else return NONODE;
 				}
 			}entry++;
 		}if(entry<FILES_DIR) break;
+		last=dblk;
 		block++; entry=0;
 		if(oblk==NULLOFF){
 			if(block==OFFS_NODE){
-				if((oblk=nodetbl[dir].blocklist)==NULLOFF){
+				if((oblk=maptbl[dir].blocklist)==NULLOFF){
 					dblk=NULLOFF;
 				}else{
 					offblock *offs=B2P(oblk);
 					dblk=offs->blocks[block=0];
 				}
-			}else dblk=nodetbl[dir].blocks[block];
+			}else dblk=maptbl[dir].blocks[block];
 		}else{
 			offblock *offs=B2P(oblk);
 			if(block==OFFS_BLOCK){
@@ -434,11 +1047,13 @@ nodei dirmod(void *fsptr, nodei dir, const char *name, nodei node, const char *r
 				}
 			}else dblk=offs->blocks[block];
 		}
-	}if(node==NONODE){
+	}MYFS_PROBE3(dirmod,dir,mode,scanned);
+	if(node==NONODE){
 		if(rename!=NULL && found!=NULL){
-			namepathset(found->name,rename);
+			nameset(found,rename,rlen,rhash);
 			return found->node;
-		}return NONODE;
+		}if(rename==NULL) negadd(fsptr,dir,name,len,hash);
+		return NONODE;
 	}if(rename!=NULL){
 		if(found==NULL) return NONODE;
 		node=found->node;
@@ -446,30 +1061,30 @@ nodei dirmod(void *fsptr, nodei dir, const char *name, nodei node, const char *r
 		if(dblk!=NULLOFF) entry--;
 		else{
 			if(oblk==NULLOFF){
-				dblk=nodetbl[dir].blocks[--block];
+				dblk=maptbl[dir].blocks[--block];
 			}else{
 				offblock *offs=B2P(oblk);
 				dblk=offs->blocks[--block];
 			}entry=FILES_DIR-1;
 		}df=(direntry*)B2P(dblk);
 		found->node=df[entry].node;
-		namepathset(found->name,df[entry].name);
+		nameset(found,df[entry].name,df[entry].len,df[entry].hash);
 		df[entry].node=NONODE;
 		if(entry==0){
 			if(oblk==NULLOFF){
-				blkfree(fsptr,1,&(nodetbl[dir].blocks[block]));
+				blkfree(fsptr,1,&(maptbl[dir].blocks[block]));
 			}else{
 				offblock *offs=B2P(oblk);
 				blkfree(fsptr,1,&(offs->blocks[block]));
 				if(block==0){
 					if(prevo==NULLOFF){
-						blkfree(fsptr,1,&(nodetbl[dir].blocklist));
+						blkfree(fsptr,1,&(maptbl[dir].blocklist));
 					}else{
 						offs=(offblock*)B2P(prevo);
 						blkfree(fsptr,1,&(offs->next));
 					}
 				}
-			}nodetbl[dir].nblocks--;
+			}maptbl[dir].nblocks--;
 		}nodetbl[dir].size--;
 		//update dir node times?
 		nodetbl[node].nlinks--;
@@ -478,28 +1093,28 @@ nodei dirmod(void *fsptr, nodei dir, const char *name, nodei node, const char *r
 		offblock *offs;
 		if(oblk==NULLOFF){
 			if(block==OFFS_NODE){
-				if(blkalloc(fsptr,1,&oblk)==0){
+				if(blkalloc(fsptr,1,&oblk,ALLOC_ZERO,NULLOFF)==0){
 					return NONODE;
-				}if(blkalloc(fsptr,1,&dblk)==0){
+				}if(blkalloc(fsptr,1,&dblk,ALLOC_ZERO,(last==NULLOFF)?NULLOFF:last+1)==0){
 					blkfree(fsptr,1,&oblk);
 					return NONODE;
-				}nodetbl[dir].blocklist=oblk;
+				}maptbl[dir].blocklist=oblk;
 				offs=(offblock*)B2P(oblk);
 				offs->blocks[0]=dblk;
 				offs->blocks[1]=NULLOFF;
 				offs->next=NULLOFF;
 			}else{
-				if(blkalloc(fsptr,1,&dblk)==0){
+				if(blkalloc(fsptr,1,&dblk,ALLOC_ZERO,(last==NULLOFF)?NULLOFF:last+1)==0){
 					return NONODE;
-				}nodetbl[dir].blocks[block]=dblk;
-				if(block<OFFS_NODE-1) nodetbl[dir].blocks[block+1]=NULLOFF;
+				}maptbl[dir].blocks[block]=dblk;
+				if(block<OFFS_NODE-1) maptbl[dir].blocks[block+1]=NULLOFF;
 			}
 		}else{
 			offs=(offblock*)B2P(oblk);
 			if(block==OFFS_BLOCK){
-				if(blkalloc(fsptr,1,&oblk)==0){
+				if(blkalloc(fsptr,1,&oblk,ALLOC_ZERO,NULLOFF)==0){
 					return NONODE;
-				}if(blkalloc(fsptr,1,&dblk)==0){
+				}if(blkalloc(fsptr,1,&dblk,ALLOC_ZERO,(last==NULLOFF)?NULLOFF:last+1)==0){
 					blkfree(fsptr,1,&oblk);
 					return NONODE;
 				}offs->next=oblk;
@@ -507,16 +1122,16 @@ nodei dirmod(void *fsptr, nodei dir, const char *name, nodei node, const char *r
 				offs->next=NULLOFF;
 				block=0;
 			}else{
-				if(blkalloc(fsptr,1,&dblk)==0){
+				if(blkalloc(fsptr,1,&dblk,ALLOC_ZERO,(last==NULLOFF)?NULLOFF:last+1)==0){
 					return NONODE;
 				}
 			}offs->blocks[block]=dblk;
-			offs->blocks[1]=NULLOFF;
-		}nodetbl[dir].nblocks++;
+			if(block<OFFS_BLOCK-1) offs->blocks[block+1]=NULLOFF;
+		}maptbl[dir].nblocks++;
 		df=(direntry*)B2P(dblk);
 	}nodetbl[dir].size++;
 	df[entry].node=node;
-	namepathset(df[entry].name,name);
+	nameset(&df[entry],name,len,hash);
 	nodetbl[node].nlinks++;
 	if(++entry<FILES_DIR) df[entry].node=NONODE;
 	return node;
@@ -524,8 +1139,9 @@ nodei dirmod(void *fsptr, nodei dir, const char *name, nodei node, const char *r
 
 nodei path2node(void *fsptr, const char *path, const char **child)
 {
+	STAT_SCOPE(ST_PATH2NODE);
 	nodei node=0;
-	size_t sub=1, ch=1;
+	size_t sub=1, ch=1, comps=0;
 	
 	if(path[0]!='/') return NONODE;
 	
@@ -535,9 +1151,22 @@ nodei path2node(void *fsptr, const char *path, const char **child)
 		}if(child!=NULL && path[ch]=='\0'){
 			*child=&path[sub];
 			break;
-		}if((node=dirmod(fsptr,node,&path[sub],NONODE,NULL))==NONODE)
-			return NONODE;
-	}return node;
+		}comps++;
+		if((node=dirmod(fsptr,node,&path[sub],NONODE,NULL))==NONODE) break;
+	}MYFS_PROBE3(path2node,path,comps,node);
+	return node;
+}
+
+int fscheck(void *fsptr, size_t fssize)
+{
+	fsheader *fshead=fsptr;
+	
+	if(fssize/BLKSZ>(sz_blk)-1) return 0;
+	//an image mapped where another was must not be answered for by the other's negative cache
+	negclear();
+	if(fshead->magic==FS_MAGIC) return 1;
+	//anything else is only taken blank, a wide image from before the magic has an older layout
+	return fshead->magic==0 && fshead->size==0;
 }
 
 void fsinit(void *fsptr, size_t fssize)
@@ -549,10 +1178,15 @@ void fsinit(void *fsptr, size_t fssize)
 	
 	if(fshead->size==fssize/BLKSZ) return;
 	
+	negclear();
 	fshead->ntsize=(BLOCKS_FILE*(1+NODES_BLOCK)+fssize/BLKSZ)/(1+BLOCKS_FILE*NODES_BLOCK);
+	if(fssize/BLKSZ>=HUGE_MIN*HUGE_BLKS) fshead->ntsize=CLDIV(fshead->ntsize,HUGE_BLKS)*HUGE_BLKS;
 	fshead->nodetbl=sizeof(inode);
 	fshead->freelist=fshead->ntsize;
 	fshead->free=fssize/BLKSZ-fshead->ntsize;
+	fshead->reserved=0;
+	fshead->orphans=0;
+	fshead->magic=FS_MAGIC;
 	
 	fhead=(freereg*)B2P(fshead->freelist);
 	fhead->size=fshead->free;
@@ -562,8 +1196,8 @@ void fsinit(void *fsptr, size_t fssize)
 	memset(nodetbl,0,fshead->ntsize*BLKSZ-sizeof(inode));
 	timespec_get(&creation,TIME_UTC);
 	nodetbl[0].mode=DIRMODE;
-	nodetbl[0].ctime=creation;
-	nodetbl[0].mtime=creation;
+	nodetbl[0].ctime=TS2NT(creation);
+	nodetbl[0].mtime=TS2NT(creation);
 	nodetbl[0].nlinks=1;
 	
 	fshead->size=fssize/BLKSZ;
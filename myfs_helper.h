@@ -14,13 +14,46 @@
 	NODEI_GOOD		nodevalid return when inode at index valid, but not linked to directory
 	NODEI_LINKD		nodevalid return when inode at index valid and linked
 	NULLOFF			NULL value for offsets and blksets
+	HOLE			blkset of a data block punched out of a file, reads as zeros and has no block behind it
 	NONODE			indicates invalid or nonexistent node
 	BLKSZ			size of blocks in fs
-	NAMELEN			max length of file names (including '\0')
-	NODES_BLOCK		number of inodes in a block
+	NAMELEN			max length of file names (including '\0'), what is left of a 256 byte direntry
+	NODES_BLOCK		number of inodes, with their maps, per block of the node table
 	FILES_DIR		number of direntries in a block
-	OFFS_NODE		number of data block offsets in an inode
+	OFFS_NODE		number of data block offsets in a nodemap
 	OFFS_BLOCK		number of data block offsets in an offblock
+	ALLOC_RAW		blkalloc mode for blocks the caller fully writes or tracks as unwritten, contents are left as found
+	ALLOC_ZERO		blkalloc mode for blocks that must read as zeros, offblocks and directory blocks
+	MAPBLKS			number of offblocks needed to map a given number of data blocks
+	MYFS_COMPACT	build flag for the compact format: 32-bit block and node numbers and 64-bit nanosecond times make
+					a node 96 bytes instead of 128, and an offblock holds twice the offsets
+	INODE_SIZE		size of an inode, one cache line in both formats, also the size of the header slot before the table
+	MAP_SIZE		size of a nodemap in the format built
+	NODEMAP			pointer to the nodemap array, after the ntsize*NODES_BLOCK inode slots, refers to existing fsptr
+	MAGIC_WIDE		fsheader magic of the default format
+	MAGIC_COMPACT	fsheader magic of the compact format
+	MAGIC_LAYOUT	low 16 bits of the magics, counting changes to the layout of the node table and directories, an image
+					of another layout is refused the same as one of the other format
+	FS_MAGIC		magic of the format built, written by fsinit
+	MAGIC_AT		byte offset of the magic in the header, the same in both formats so each can recognize the other
+	TS2NT,NT2TS		convert a struct timespec to the inode time type and back, a timespec or nanoseconds since the epoch
+	PREALLOC_MIN	fewest blocks fextend reserves past the end of a growing file
+	PREALLOC_MAX	most blocks fextend reserves past the end of a growing file
+	PREALLOC_SHARE	fextend reserves at most 1/PREALLOC_SHARE of the free blocks
+	IO_READ			fileio mode copying from the file to buf
+	IO_WRITE		fileio mode copying from buf to the file
+	IO_ZERO			fileio mode zeroing the file, buf is unused
+	IO_FILL			fileio mode allocating blocks for the holes of the file, buf is unused
+	NODE_KEEP		inode flag, the blocks past the end were preallocated and are kept until the file is truncated
+	NODE_ORPHAN		inode flag, the node is on the orphan list and its blocks are freed in the background
+	NODE_OPEN		inode flag, the file was unlinked while the kernel holds it, the node is not reused until it is forgotten
+	FREE_BATCH		most blocks gathered by blkqueue before they are freed together, or allocated together for a grow,
+					more than an offblock maps so an offblock and its run always fit in one batch
+	ORPHAN_MIN		fewest blocks an unlink or truncate leaves to the orphan list instead of freeing them itself
+	RUNS_MAX		most runs fruns is asked for at once, the length of its callers' arrays
+	HUGE_BLKS		number of blocks in a 2MB huge page
+	HUGE_MIN		fewest huge pages in an image for fsinit to round the node table up to a multiple of HUGE_BLKS,
+					so the header and node table fill whole huge pages and the data region starts on one
 */
 /*Helper Types
 	nodei			used for indices into the node table -> file identifiers
@@ -28,6 +61,8 @@
 	offset			byte offset from the beggining of the file system
 	blkset			block offset from the beginning of the file system
 	sz_blk			size in blocks
+	nodetime		inode time stamp
+	blkset, sz_blk and nodei are 32 bits wide in the compact format, offset stays a size_t as it is used for byte offsets
 	
 	fpos			used to store a position in a file
 		node			file node, NONODE for invalid files
@@ -39,65 +74,152 @@
 		data			offset to data position, NULLOFF at EOF
 	direntry		directory entry
 		node			file/subdir inode number, NONODE for the entry past the last in a directory, if one exists
+		hash			namehash of the name, compared first so most entries that do not match cost one compare
+		len				length of the name, excluding '\0'
 		name			name of the file or subdirectory
 	offblock		block containing offsets to data blocks
 		next			blkset to next offblock if one exists, otherwise NULLOFF
 		blocks			data block blksets, all blksets past the last are NULLOFF
-	inode			file/directory metadata and location of file data
+	inode			file/directory metadata, the attributes stat and path lookup read, one cache line per node
 		mode			unix mode of the file, set to FILEMODE for regular files, DIRMODE for directories
+		flags			NODE_KEEP, NODE_ORPHAN, NODE_OPEN or 0
 		nlinks			number of links to node
 		size			file size, in bytes, or number of entries in a directory
-		nblocks			total number of data blocks allocated to the file, excludes offblocks
 		atime			time of last access
 		mtime			time of last modification
 		ctime			creation time/time of last change to inode
-		blocks			blksets to first OFFS_NODE or fewer data blocks
+	nodemap			location of file data, kept in an array of its own after the inodes, indexed by the same node
+		nblocks			total number of data blocks mapped by the file, excludes offblocks and includes holes,
+						for regular files this is more than the size needs while blocks are reserved past the end
 		blocklist		blkset to first offblock, or NULLOFF
+		vsize			valid size of a regular file, bytes from vsize to size are unwritten and read as zeros whatever
+						their blocks hold, so blocks need not be zeroed when allocated or when the file grows
+		next			in place of vsize for a NODE_ORPHAN node, the next node on the orphan list, 0 at its end
+		blocks			blksets to first OFFS_NODE or fewer data blocks
 	freereg			continuous region of free blocks
 		next			blkset of next free region, or NULLOFF
 		size			number of blocks in the free region
+	blkbatch		blocks allocated together for a growing file and handed out one at a time
+		blks			the blocks, in the order blkalloc gave them
+		next			index of the next block to hand out, have when all are used
+		have			number of blocks in blks
+		left			number of blocks still to allocate for the grow
+		goal			block the next batch is allocated from
 	fsheader		global filesystem header
 		size			size of the filesystem in blocks, used to determine if the filesystem has been initialized
 		free			number of free blocks in the filesystem
 		freelist		blkset of first freereg, or NULLOFF
 		ntsize			number of blocks used for the node table
-		nodetbl			offset to the node table
+		nodetbl			offset to the inode array of the node table, the nodemap array follows it at NODEMAP
+		reserved		blocks files hold past the blocks their size needs, counted as free by statfs
+		orphans			first node on the orphan list, 0 when it is empty: unlinked nodes, and nodes holding the
+						tails cut off truncated files, whose blocks are still to be freed
+		magic			FS_MAGIC of the build that formatted the image, at MAGIC_AT, 0 in wide images from before it
+						and in blank ones
 */
 /*Helper Functions
 	offsort,filter,swap
 		heap sort, used by blkfree
-	blkalloc(fsptr, count, *buf)
+	blkalloc(fsptr, count, *buf, mode, goal)
 		allocates up to count blocks and places their blksets in buf, returns number of blocks allocated
+		mode ALLOC_ZERO zeroes the blocks, ALLOC_RAW leaves them as they are
+		goal is the block the caller would like first, NULLOFF for no preference: if goal is free the blocks are
+		taken from goal on, else from the first free region past goal that holds them all, else from the first
+		region before it that does, and whatever is still missing from the head of the free list
 	blkfree(fsptr, count, *buf)
 		frees up to count blocks from buf, sets values in buf to NULLOFF, returns number of blocks freed
+		buf is sorted first, then all of it is merged into the free list in one pass
+	blkqueue(fsptr, *batch, *ct, *buf, count)
+		moves count blksets from buf to the FREE_BATCH entries of batch, which hold *ct, setting them to NULLOFF in buf,
+		and frees the batch with blkfree whenever it is full, returns the number freed, the caller frees the rest
 	newnode(fsptr)
-		finds the first unlinked node in the node table, returns NONODE if one deos not exist
+		finds the first unlinked node in the node table, returns NONODE if one deos not exist, NODE_OPEN nodes are skipped
 	nodevalid(fsptr, node)
 		checks validity of node, returns one of NODEI_BAD, NODEI_GOOD, NODEI_LINKD as described above
 	loadpos(fsptr, *pos, node)
 		loads fpos pos to the beginning of the file at node, returns 0 on success, -1 when given a bad node of fpos
 	advance(fsptr, *pos, blks)
 		moves pos ahead in the file up to the next blks blocks, at the start of the block, returns actual advancement
+		the target slot is computed from its block number, so only the offblocks up to it are read
 	seek(fsptr, *pos, off)
 		moves pos ahead up to off bytes/entries in the file/dir, returns actual advancement
-	frealloc(fsptr, node, off)
+	nodegoal(fsptr, node)
+		returns the block after the last data block of node, the allocation goal to keep node contiguous,
+		or NULLOFF if node has no blocks
+	frealloc(fsptr, node, off, goal)
 		tries to change file size to exactly off bytes, only for regular files, returns 0 on success, -1 on failure
-	namepathset(*name, *path)
-		like strcpy, copies path to name, but also considers '/' to inicate the end of path
-	namepatheq(*name, *path)
-		similar to strcmp, checks if name and path equal, treats '/' as above, returns 1 if equal, 0 otherwise
+		new data blocks are not zeroed, growing leaves vsize as is and shrinking lowers it to off
+		new blocks continue the file's last block, goal is only used for the first block of an empty file
+		blocks reserved past the end are released, and when space runs out so are the reservations of all files
+	fextend(fsptr, node, off, goal)
+		like frealloc, but only grows, for appends: when the file needs more blocks it reserves up to as many again
+		past the end, between PREALLOC_MIN and PREALLOC_MAX, so the appends that follow only move the size
+	fpalloc(fsptr, node, off, len, keep, goal)
+		makes sure the bytes from off to off+len have blocks, the new ones unzeroed and read as zeros,
+		holes in the range get blocks and the map is extended as needed, the size grows to off+len unless keep,
+		in which case the blocks past the end are NODE_KEEP, returns 0 on success, -1 on failure
+	fpunch(fsptr, node, off, len)
+		frees the blocks entirely within off to off+len, leaving holes, and zeroes the rest of the range
+		where it holds valid data, the size does not change, returns 0 on success, -1 on failure
+	ftrim(fsptr, node)
+		releases the blocks reserved past the end of node, unless NODE_KEEP, returns the number released
+	fstrim(fsptr)
+		releases the blocks reserved past the end of every file and frees the blocks of every orphan,
+		returns the number released
+	forphan(fsptr, node, size)
+		for a shrink of node to size that frees at least ORPHAN_MIN blocks, moves the blocks onto the orphan list
+		instead, an unlinked node goes on it whole, a truncated file gives the offblocks past size to a new node,
+		returns the number of blocks moved, 0 when it did nothing and the caller frees the blocks with frealloc
+	freclaim(fsptr, maxblks)
+		frees about maxblks blocks from the orphan list, whole offblocks at a time from the front of the first
+		orphan's map, an orphan with no blocks left is taken off the list, returns the number freed, 0 when empty
+	frecover(fsptr)
+		puts unlinked nodes that hold blocks but are not on the orphan list onto it, returns the number found,
+		and clears NODE_OPEN from unlinked nodes, the kernel that held them is gone
+	fdefrag(fsptr, node, maxblks)
+		moves up to maxblks data blocks of node so the file becomes one contiguous run, returns the number moved,
+		0 when the file is contiguous, has holes, or no free run is long enough
+		a file that can grow on from its first extent keeps it, otherwise it goes to the smallest free region
+		it fits in, called again it continues where it stopped
+	fruns(fsptr, node, off, len, *first, *count, max)
+		finds where the data blocks of node holding bytes off to off+len lie, as up to max runs of blocks that
+		follow each other on disk, run i being count[i] blocks from first[i], holes are left out,
+		returns the number of runs, which stop early when max is reached
+	fileio(fsptr, node, off, *buf, len, mode)
+		copies len bytes between buf and the data blocks of node starting at byte off, a run of blocks that
+		follow each other on disk at a time,
+		in the direction given by mode, stops at the last allocated block, ignores size and vsize,
+		holes read as zeros and are given blocks by writes, returns number of bytes copied,
+		short when a hole could not be given a block
+	namelen(*path)
+		like strlen, but also considers '/' to indicate the end of path, scans 16 or 32 bytes at a time with aligned
+		loads when built for SSE2 or AVX2, a byte at a time otherwise
+	namehash(*name, len)
+		32-bit FNV-1a hash of the first len bytes of name
+	nameeq(*a, *b, len)
+		checks if the first len bytes of a and b are equal, 16 or 32 at a time as above, returns 1 if so, 0 otherwise
+	nameset(*ent, *path, len, hash)
+		copies the first len bytes of path to the name of ent and terminates it, and sets the len and hash of ent
 	dirmod(fsptr, dir, *name, node, *rename)
 		performs operations on directory dir based on the values of node and rename, returns NONODE on failure
 		node  NONODE, rename  NULL:	searches for name in dir and returns the node of the entry if found
 		node  valid,  rename  NULL:	add an entry with name name if one does not exist  and link to node, returns node
 		node  NONODE, rename !NULL:	find name in dir and changes its name to rename if not already present
 		node !NONODE, rename !NULL:	find name in dir and remove it, return node of removed entry on success
+		a lookup that finds nothing is remembered in a negative cache of NEG_SLOTS entries in process memory, and
+		answered from it without a scan until an add or rename puts the name in dir, fsinit and fscheck empty it,
+		the cache is shared by the images of the process, keyed by fsptr and guarded by a lock of its own
 	path2node(fsptr, *path, **child)
 		finds node of the file corresponding to path, returns NONODE if one does not exist
 		if child!=NULL, instead returns node of path's parent dir and sets *child to the filename
+	fscheck(fsptr,fssize)
+		checks the image is blank or in the format and layout of this build before it is first used, returns 1 if
+		so, 0 if it is in the other format or an older layout, written by something else, or too large for the
+		compact format's block numbers
 	fsinit(fsptr,fssize)
 		check if the filesystem has been initialized, if not, initialize it to as many blocks fit in fssize
 		always succeeds: only two blocks are needed for a working filesystem, and fssize is given as at least 2048
+		in images of HUGE_MIN huge pages or more the node table is rounded up to end on a huge page boundary
 */
 
 #include <stddef.h>
@@ -126,20 +248,65 @@
 #define NODEI_LINKD	2
 
 #define NULLOFF		(offset)0
+#define HOLE		(blkset)-1
 #define NONODE		(nodei)-1
 #define BLKSZ		(size_t)1024
-#define NAMELEN		(256-sizeof(nodei))
-#define NODES_BLOCK	(BLKSZ/sizeof(inode))
+#define NAMELEN		(256-sizeof(nodei)-2*sizeof(uint32_t))
+#define NODES_BLOCK	(BLKSZ/(sizeof(inode)+sizeof(nodemap)))
 #define FILES_DIR	(BLKSZ/sizeof(direntry))
 #define OFFS_BLOCK	(BLKSZ/sizeof(blkset)-1)
+#define INODE_SIZE	64
+#ifdef MYFS_COMPACT
+#define OFFS_NODE	4
+#define MAP_SIZE	32
+#define FS_MAGIC	MAGIC_COMPACT
+#else
 #define OFFS_NODE	5
+#define MAP_SIZE	64
+#define FS_MAGIC	MAGIC_WIDE
+#endif
+#define NODEMAP(fshead)	(nodemap*)O2P((fshead)->ntsize*NODES_BLOCK*sizeof(inode))
+#define MAGIC_LAYOUT	(uint64_t)0x0002
+#define MAGIC_WIDE	((uint64_t)0x4d59465336340000|MAGIC_LAYOUT)
+#define MAGIC_COMPACT	((uint64_t)0x4d59465333320000|MAGIC_LAYOUT)
+#define MAGIC_AT	56
 #define BLOCKS_FILE	4
+#define ALLOC_RAW	0
+#define ALLOC_ZERO	1
+#define PREALLOC_MIN	8
+#define PREALLOC_MAX	4096
+#define PREALLOC_SHARE	16
+#define IO_READ		0
+#define IO_WRITE	1
+#define IO_ZERO		2
+#define IO_FILL		3
+#define NODE_KEEP	1
+#define NODE_ORPHAN	2
+#define NODE_OPEN	4
+#define FREE_BATCH	1024
+#define ORPHAN_MIN	4096
+#define RUNS_MAX	64
+#define HUGE_BLKS	(((size_t)2<<20)/BLKSZ)
+#define HUGE_MIN	64
+#define MAPBLKS(n)	(((n)<=OFFS_NODE)?0:((n)-OFFS_NODE+OFFS_BLOCK-1)/OFFS_BLOCK)
 
 typedef size_t blkdex;
 typedef size_t offset;
+#ifdef MYFS_COMPACT
+typedef uint32_t blkset;
+typedef uint32_t sz_blk;
+typedef int32_t nodei;
+typedef uint64_t nodetime;
+#define TS2NT(ts)	((nodetime)(ts).tv_sec*1000000000+(ts).tv_nsec)
+#define NT2TS(nt)	((struct timespec){(time_t)((nt)/1000000000),(long)((nt)%1000000000)})
+#else
 typedef size_t blkset;
 typedef size_t sz_blk;
 typedef ssize_t nodei;
+typedef struct timespec nodetime;
+#define TS2NT(ts)	(ts)
+#define NT2TS(nt)	(nt)
+#endif
 
 typedef struct{
 	nodei node;
@@ -152,6 +319,8 @@ typedef struct{
 } fpos;
 typedef struct{
 	nodei node;
+	uint32_t hash;
+	uint32_t len;
 	char name[NAMELEN];
 } direntry;
 typedef struct{
@@ -159,39 +328,82 @@ typedef struct{
 	blkset blocks[OFFS_BLOCK];
 } offblock;
 typedef struct{
-	mode_t mode;
-	size_t nlinks;
-	size_t size;
+	uint16_t mode;
+	uint16_t flags;
+	uint32_t nlinks;
+	uint64_t size;
+	nodetime atime;
+	nodetime mtime;
+	nodetime ctime;
+#ifdef MYFS_COMPACT
+	uint8_t unused[24];
+#endif
+} inode;
+typedef struct{
 	sz_blk nblocks;
-	struct timespec atime;
-	struct timespec mtime;
-	struct timespec ctime;
-	
-	blkset blocks[OFFS_NODE];
 	blkset blocklist;
-} inode;
+	union{
+		uint64_t vsize;
+		nodei next;
+	};
+	blkset blocks[OFFS_NODE];
+} nodemap;
 typedef struct{
 	sz_blk size;
 	blkset next;
 } freereg;
+typedef struct{
+	blkset blks[FREE_BATCH];
+	sz_blk next;
+	sz_blk have;
+	sz_blk left;
+	blkset goal;
+} blkbatch;
 typedef struct{
 	sz_blk size;
 	sz_blk free;
 	blkset freelist;
 	sz_blk ntsize;
 	offset nodetbl;
+	sz_blk reserved;
+	nodei orphans;
+#ifdef MYFS_COMPACT
+	uint32_t unused[6];
+#endif
+	uint64_t magic;
 } fsheader;
 
-sz_blk blkalloc(void *fsptr, sz_blk count, blkset *buf);
+_Static_assert(sizeof(inode)==INODE_SIZE,"inode does not fill its cache line");
+_Static_assert(sizeof(nodemap)==MAP_SIZE,"nodemap does not fill its slot");
+_Static_assert(sizeof(direntry)==256,"direntry does not fill its slot");
+_Static_assert(offsetof(fsheader,magic)==MAGIC_AT,"magic must sit where either format can find it");
+
+sz_blk blkalloc(void *fsptr, sz_blk count, blkset *buf, int mode, blkset goal);
 sz_blk blkfree(void *fsptr, sz_blk count, blkset *buf);
+sz_blk blkqueue(void *fsptr, blkset *batch, sz_blk *ct, blkset *buf, sz_blk count);
 nodei newnode(void *fsptr);
 int nodevalid(void *fsptr, nodei node);
 void loadpos(void *fsptr, fpos *pos, nodei node);
 sz_blk advance(void *fsptr, fpos *pos, sz_blk blks);
 size_t seek(void *fsptr, fpos *pos, size_t off);
-int frealloc(void *fsptr, nodei node, size_t size);
-void namepathset(char *name, const char *path);
-int namepatheq(char *name, const char *path);
+blkset nodegoal(void *fsptr, nodei node);
+int frealloc(void *fsptr, nodei node, size_t size, blkset goal);
+int fextend(void *fsptr, nodei node, size_t size, blkset goal);
+int fpalloc(void *fsptr, nodei node, size_t off, size_t len, int keep, blkset goal);
+int fpunch(void *fsptr, nodei node, size_t off, size_t len);
+sz_blk ftrim(void *fsptr, nodei node);
+sz_blk fstrim(void *fsptr);
+sz_blk forphan(void *fsptr, nodei node, size_t size);
+sz_blk freclaim(void *fsptr, sz_blk maxblks);
+sz_blk frecover(void *fsptr);
+sz_blk fdefrag(void *fsptr, nodei node, sz_blk maxblks);
+size_t fruns(void *fsptr, nodei node, size_t off, size_t len, blkset *first, sz_blk *count, size_t max);
+size_t fileio(void *fsptr, nodei node, size_t off, void *buf, size_t len, int mode);
+size_t namelen(const char *path);
+uint32_t namehash(const char *name, size_t len);
+int nameeq(const char *a, const char *b, size_t len);
+void nameset(direntry *ent, const char *path, size_t len, uint32_t hash);
 nodei dirmod(void *fsptr, nodei dir, const char *name, nodei node, const char *rename);
 nodei path2node(void *fsptr, const char *path, const char **child);
+int fscheck(void *fsptr, size_t fssize);
 void fsinit(void *fsptr, size_t fssize);
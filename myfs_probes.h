@@ -0,0 +1,62 @@
+/*CSCE321 HW4: myfs
+	myfs_probes.h: static tracepoints for perf and bpftrace
+*/
+
+/*Probe Macros
+	MYFS_PROBE1..MYFS_PROBE4(name, args...)
+		static tracepoint myfs:name with one to four integer or pointer arguments
+		with MYFS_PROBES defined, and <sys/sdt.h> from systemtap available, these are USDT probes: a single nop in
+			the code and a note in the binary which perf probe and bpftrace attach to, as usdt:./myfs:myfs:name
+		otherwise they compile to nothing, the arguments are only referenced so the variables kept for them do not
+			warn, and the compiler drops the code computing them
+*/
+/*Probes
+	blkalloc(count, alloct, regions)
+		request for count blocks, alloct blocks allocated from regions free regions
+	blkfree(count, freect, regions)
+		request to free count blocks, freect blocks freed, regions free regions walked or created
+	dirmod(dir, mode, scanned)
+		one directory operation on dir, mode is one of PROBE_LOOKUP, PROBE_ADD, PROBE_RENAME, PROBE_REMOVE,
+		fired when the scan of dir is done, after scanned entries were compared, or PROBE_NEGHIT for a lookup
+		the negative cache answered without a scan
+	path2node(path, components, node)
+		lookup of path, components directories were looked up, node is the node returned
+	frealloc(node, oldblocks, newblocks)
+		file node resized from oldblocks to newblocks data blocks, fired after the resize succeeded
+	read(node, bytes, blocks)
+		read of bytes bytes from node, touching blocks data blocks
+	write(node, bytes, blocks)
+		write of bytes bytes to node, touching blocks data blocks
+*/
+
+#ifndef MYFS_PROBES_H
+#define MYFS_PROBES_H
+
+#define PROBE_LOOKUP	0
+#define PROBE_ADD		1
+#define PROBE_RENAME	2
+#define PROBE_REMOVE	3
+#define PROBE_NEGHIT	4
+
+#if defined(MYFS_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MYFS_PROBES_SDT
+#else
+#warning "MYFS_PROBES defined but <sys/sdt.h> not found, probes are disabled"
+#endif
+#endif
+
+#ifdef MYFS_PROBES_SDT
+#define MYFS_PROBE1(name,a)			DTRACE_PROBE1(myfs,name,a)
+#define MYFS_PROBE2(name,a,b)		DTRACE_PROBE2(myfs,name,a,b)
+#define MYFS_PROBE3(name,a,b,c)		DTRACE_PROBE3(myfs,name,a,b,c)
+#define MYFS_PROBE4(name,a,b,c,d)	DTRACE_PROBE4(myfs,name,a,b,c,d)
+#else
+#define MYFS_PROBE1(name,a)			((void)(a))
+#define MYFS_PROBE2(name,a,b)		((void)(a),(void)(b))
+#define MYFS_PROBE3(name,a,b,c)		((void)(a),(void)(b),(void)(c))
+#define MYFS_PROBE4(name,a,b,c,d)	((void)(a),(void)(b),(void)(c),(void)(d))
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+/*CSCE321 HW4: myfs
+	myfs_stats.c: per-thread operation counters and latency histograms
+*/
+
+/*Stats Internals
+	Every thread gets its own statblk the first time it records anything, so recording never takes a lock
+		blocks are pushed onto a global list with compare-and-swap and are never freed,
+		when a thread exits its block is marked unowned and the next new thread adopts it instead of allocating,
+		so the list stays as long as the largest number of threads alive at once
+	Counters are written only by their owning thread, with relaxed atomic stores so a concurrent report never sees torn values
+	Latencies go into log-linear histograms, HDR style: the bucket is the position of the top bit of the value in ns,
+		split into 2^HIST_SUB linear sub-buckets by the bits below it, which bounds the percentile error to 1/2^HIST_SUB
+	Times are inclusive: a dirmod called from path2node is counted under both
+	This module holds the only process-wide state of the filesystem, since the helpers have no handle to hang it off,
+		none of it is stored in the filesystem memory
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "myfs_stats.h"
+
+typedef struct statblk{
+	uint64_t count[ST_COUNT];
+	uint64_t errors[ST_COUNT];
+	uint64_t total[ST_COUNT];
+	uint64_t max[ST_COUNT];
+	uint64_t hist[ST_COUNT][HIST_BUCKETS];
+	int owned;
+	struct statblk *next;
+} statblk;
+
+static const char *stat_names[ST_COUNT]={
+	"getattr", "readdir", "mknod", "unlink", "mkdir", "rmdir", "rename", "truncate",
+	"open", "read", "write", "statfs", "utimens", "fsync", "release",
+	"fallocate", "lookup", "forget",
+	"path2node", "dirmod", "blkalloc", "blkfree", "frealloc", "seek", "defrag", "reclaim"
+};
+
+static statblk *stat_list=NULL;
+static __thread statblk *stat_mine=NULL;
+static pthread_key_t stat_key;
+static pthread_once_t stat_once=PTHREAD_ONCE_INIT;
+static uint64_t stat_epoch;
+static pthread_mutex_t report_lock=PTHREAD_MUTEX_INITIALIZER;
+static size_t (*report_extra)(char *buf, size_t len, void *arg)=NULL;
+static void *report_arg=NULL;
+
+uint64_t stat_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static void stat_release(void *blk)
+{
+	__atomic_store_n(&((statblk*)blk)->owned,0,__ATOMIC_RELEASE);
+}
+
+static void stat_init(void)
+{
+	pthread_key_create(&stat_key,stat_release);
+	stat_epoch=stat_now();
+}
+
+static statblk *stat_block(void)
+{
+	statblk *blk;
+
+	if(stat_mine!=NULL) return stat_mine;
+	pthread_once(&stat_once,stat_init);
+	for(blk=__atomic_load_n(&stat_list,__ATOMIC_ACQUIRE);blk!=NULL;blk=blk->next){
+		int unowned=0;
+		if(__atomic_compare_exchange_n(&blk->owned,&unowned,1,0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)) break;
+	}if(blk==NULL){
+		if((blk=calloc(1,sizeof(statblk)))==NULL) return NULL;
+		blk->owned=1;
+		blk->next=__atomic_load_n(&stat_list,__ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&stat_list,&blk->next,blk,0,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+	}pthread_setspecific(stat_key,blk);
+	return stat_mine=blk;
+}
+
+static size_t stat_bucket(uint64_t ns)
+{
+	size_t top;
+
+	if(ns<((uint64_t)1<<HIST_SUB)) return ns;
+	top=63-__builtin_clzll(ns);
+	if(top>=40) return HIST_BUCKETS-1;
+	return ((top-HIST_SUB+1)<<HIST_SUB)+((ns>>(top-HIST_SUB))&(((uint64_t)1<<HIST_SUB)-1));
+}
+
+static uint64_t stat_bucketmax(size_t bucket)
+{
+	size_t top=(bucket>>HIST_SUB)+HIST_SUB-1;
+	uint64_t sub=bucket&(((uint64_t)1<<HIST_SUB)-1);
+
+	if(bucket<((size_t)1<<HIST_SUB)) return bucket;
+	return (((uint64_t)1<<HIST_SUB|sub)+1)<<(top-HIST_SUB);
+}
+
+#define MIN_NS(A,B)		(((A)<=(B))?(A):(B))
+#define BUMP(field,val)	__atomic_store_n(&(field),(field)+(val),__ATOMIC_RELAXED)
+
+void stat_end(int id, uint64_t start, int failed)
+{
+	statblk *blk=stat_block();
+	uint64_t ns=stat_now()-start;
+
+	if(blk==NULL) return;
+	BUMP(blk->count[id],1);
+	BUMP(blk->total[id],ns);
+	BUMP(blk->hist[id][stat_bucket(ns)],1);
+	if(failed) BUMP(blk->errors[id],1);
+	if(ns>blk->max[id]) __atomic_store_n(&blk->max[id],ns,__ATOMIC_RELAXED);
+}
+
+void stat_leave(statscope *scope)
+{
+	stat_end(scope->id,scope->start,0);
+}
+
+static uint64_t stat_pct(uint64_t *hist, uint64_t count, uint64_t max, double p)
+{
+	uint64_t want=(uint64_t)(p*count+0.5), seen=0;
+	size_t i;
+
+	if(want==0) want=1;
+	for(i=0;i<HIST_BUCKETS;i++){
+		if((seen+=hist[i])>=want) return MIN_NS(stat_bucketmax(i),max);
+	}return max;
+}
+
+size_t stat_report(char *buf, size_t len)
+{
+	static uint64_t hist[HIST_BUCKETS];
+	double uptime;
+	size_t out=0;
+	statblk *blk;
+	int id;
+
+#define EMIT(...)	out+=snprintf((out<len)?buf+out:NULL,(out<len)?len-out:0,__VA_ARGS__)
+	pthread_once(&stat_once,stat_init);
+	pthread_mutex_lock(&report_lock);
+	uptime=(stat_now()-stat_epoch)/1e9;
+	EMIT("uptime %.1fs, latencies in us\n",uptime);
+	EMIT("%-10s %12s %10s %10s %10s %10s %10s %10s %10s %10s\n","op","count","errors","ops/s",
+		"mean","p50","p90","p99","p99.9","max");
+	for(id=0;id<ST_COUNT;id++){
+		uint64_t count=0, errors=0, total=0, max=0;
+		size_t i;
+		memset(hist,0,sizeof(hist));
+		for(blk=__atomic_load_n(&stat_list,__ATOMIC_ACQUIRE);blk!=NULL;blk=blk->next){
+			uint64_t m=__atomic_load_n(&blk->max[id],__ATOMIC_RELAXED);
+			count+=__atomic_load_n(&blk->count[id],__ATOMIC_RELAXED);
+			errors+=__atomic_load_n(&blk->errors[id],__ATOMIC_RELAXED);
+			total+=__atomic_load_n(&blk->total[id],__ATOMIC_RELAXED);
+			if(m>max) max=m;
+			for(i=0;i<HIST_BUCKETS;i++) hist[i]+=__atomic_load_n(&blk->hist[id][i],__ATOMIC_RELAXED);
+		}if(count==0) continue;
+		for(i=0,count=0;i<HIST_BUCKETS;i++) count+=hist[i];
+		EMIT("%-10s %12lu %10lu %10.1f %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",stat_names[id],count,errors,
+			(uptime>0)?count/uptime:0.0,total/1e3/count,stat_pct(hist,count,max,0.5)/1e3,stat_pct(hist,count,max,0.9)/1e3,
+			stat_pct(hist,count,max,0.99)/1e3,stat_pct(hist,count,max,0.999)/1e3,max/1e3);
+	}if(report_extra!=NULL) out+=report_extra((out<len)?buf+out:NULL,(out<len)?len-out:0,report_arg);
+	pthread_mutex_unlock(&report_lock);
+#undef EMIT
+	return out;
+}
+
+void stat_dump(int fd)
+{
+	size_t len=stat_report(NULL,0), done=0, got;
+	char *buf=malloc(len+1);
+	ssize_t res;
+
+	if(buf==NULL) return;
+	if((got=stat_report(buf,len+1))<len) len=got;
+	while(done<len && (res=write(fd,buf+done,len-done))>0) done+=res;
+	free(buf);
+}
+
+void stat_extra(size_t (*fn)(char *buf, size_t len, void *arg), void *arg)
+{
+	pthread_mutex_lock(&report_lock);
+	report_extra=fn;
+	report_arg=arg;
+	pthread_mutex_unlock(&report_lock);
+}
@@ -0,0 +1,73 @@
+/*CSCE321 HW4: myfs
+	myfs_stats.h: per-thread operation counters and latency histograms
+*/
+
+/*Stats Constants
+	ST_*			operation ids: one per FUSE callback, then the instrumented helpers
+	ST_COUNT		number of operation ids
+	HIST_SUB		sub-buckets per power of two in the latency histograms, as a power of two
+	HIST_BUCKETS	number of histogram buckets, covering 1ns up to about 18 minutes
+*/
+/*Stats Types
+	statscope		start of a timed region, used by STAT_SCOPE
+		id				operation id
+		start			start time in ns
+*/
+/*Stats Functions
+	stat_now()
+		monotonic time in ns
+	stat_end(id, start, failed)
+		records one operation of type id which started at start, counting it as an error if failed is nonzero
+	stat_leave(*scope)
+		records the operation of a statscope as successful, for use as a cleanup function
+	stat_report(*buf, len)
+		formats a snapshot of all counters into buf as text, returns the full length of the report even if it
+		did not fit into len bytes, so it can be called with len 0 to size a buffer
+	stat_dump(fd)
+		writes a report to fd
+	stat_extra(fn, arg)
+		has every report end with what fn(buf, len, arg) formats, fn follows the contract of stat_report,
+		NULL removes it, waits for a report in progress so arg may be freed once it returns
+*/
+/*Stats Macros
+	STAT_SCOPE(id)
+		times the rest of the enclosing block as one operation of type id, however the block is left
+		compiles to nothing when MYFS_NOSTATS is defined
+*/
+
+#ifndef MYFS_STATS_H
+#define MYFS_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum{
+	ST_GETATTR, ST_READDIR, ST_MKNOD, ST_UNLINK, ST_MKDIR, ST_RMDIR, ST_RENAME, ST_TRUNCATE,
+	ST_OPEN, ST_READ, ST_WRITE, ST_STATFS, ST_UTIMENS, ST_FSYNC, ST_RELEASE,
+	ST_FALLOCATE, ST_LOOKUP, ST_FORGET,
+	ST_PATH2NODE, ST_DIRMOD, ST_BLKALLOC, ST_BLKFREE, ST_FREALLOC, ST_SEEK, ST_DEFRAG, ST_RECLAIM,
+	ST_COUNT
+};
+
+#define HIST_SUB		3
+#define HIST_BUCKETS	(41<<HIST_SUB)
+
+typedef struct{
+	int id;
+	uint64_t start;
+} statscope;
+
+uint64_t stat_now(void);
+void stat_end(int id, uint64_t start, int failed);
+void stat_leave(statscope *scope);
+size_t stat_report(char *buf, size_t len);
+void stat_dump(int fd);
+void stat_extra(size_t (*fn)(char *buf, size_t len, void *arg), void *arg);
+
+#ifndef MYFS_NOSTATS
+#define STAT_SCOPE(id)	statscope __stat_scope __attribute__((cleanup(stat_leave)))={(id),stat_now()}
+#else
+#define STAT_SCOPE(id)	do{}while(0)
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+/*CSCE321 HW4: myfs
+	myfs_trace.c: binary ring buffer trace of FUSE operations
+*/
+
+/*Trace Internals
+	The trace file is a header slot followed by a ring of fixed size slots, mapped shared so records cost a memcpy,
+		the kernel writes them back to the file in its own time and trace_close flushes the rest
+	A record is a start slot with the fixed fields and the first bytes of its path, followed by as many
+		continuation slots as the rest of the path needs, most paths fit in the start slot
+	Records are written under the trace's own lock, outside env_lock, so tracing never lengthens the time
+		env_lock is held, head is only advanced once the whole record is in place
+	When the ring wraps the oldest records are overwritten slot by slot, continuation slots left at the
+		start of the ring by an overwritten start slot are skipped by the reader
+	Data read or written is not recorded, only its offset and size
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "myfs_stats.h"
+#include "myfs_trace.h"
+
+_Static_assert(sizeof(traceslot)==TRACE_SLOT && sizeof(tracecont)==TRACE_SLOT && sizeof(tracehead)==TRACE_SLOT,
+	"trace slots must be TRACE_SLOT bytes");
+
+#define CONT_SLOTS(len)	(((len)>TRACE_INLINE)?((len)-TRACE_INLINE+TRACE_CONT-1)/TRACE_CONT:0)
+
+tracebuf *trace_open(const char *file, size_t slots)
+{
+	struct timespec ts;
+	tracebuf *trace;
+	size_t maplen;
+	int fd, err;
+
+	if(slots<2 || slots>(SIZE_MAX-sizeof(tracehead))/TRACE_SLOT){
+		errno=EINVAL;
+		return NULL;
+	}maplen=sizeof(tracehead)+slots*TRACE_SLOT;
+	if((trace=malloc(sizeof(tracebuf)))==NULL) return NULL;
+	if((fd=open(file,O_CREAT|O_RDWR|O_TRUNC,00644))<0){
+		free(trace);
+		return NULL;
+	}//reserve the space now, a page of the ring that cannot be written back would be a SIGBUS later
+	if((err=posix_fallocate(fd,0,maplen))!=0 ||
+		(trace->head=mmap(NULL,maplen,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==MAP_FAILED){
+		if(err!=0) errno=err;
+		err=errno;
+		close(fd);
+		free(trace);
+		errno=err;
+		return NULL;
+	}close(fd);
+	clock_gettime(CLOCK_REALTIME,&ts);
+	trace->head->magic=TRACE_MAGIC;
+	trace->head->slots=slots;
+	trace->head->head=0;
+	trace->head->epoch=(uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+	trace->maplen=maplen;
+	trace->epoch=stat_now();
+	pthread_mutex_init(&trace->lock,NULL);
+	return trace;
+}
+
+void trace_log(tracebuf *trace, int op, const char *path, const char *path2, int64_t offset, size_t size,
+	uint64_t start, int res)
+{
+	size_t len1=strlen(path), len=len1, done, n, i;
+	uint64_t dur=stat_now()-start, pos;
+	traceslot *slot;
+	tracecont *cont;
+
+	if(path2!=NULL) len+=1+strlen(path2);
+	if(len>TRACE_MAXPATH) len=TRACE_MAXPATH;
+	n=CONT_SLOTS(len);
+	pthread_mutex_lock(&trace->lock);
+	pos=trace->head->head;
+	slot=trace_slot(trace->head,pos);
+	slot->kind=TR_START;
+	slot->op=op;
+	slot->len=len;
+	slot->res=res;
+	slot->start=(start>trace->epoch)?start-trace->epoch:0;
+	slot->dur=(dur>UINT32_MAX)?UINT32_MAX:dur;
+	slot->size=(size>UINT32_MAX)?UINT32_MAX:size;
+	slot->offset=offset;
+	//the path data is path, then a NUL and path2 for rename, copied in pieces across the slots
+	for(i=0,done=0;i<=n;i++){
+		char *dst;
+		size_t room, k;
+		if(i==0){
+			dst=slot->path;
+			room=TRACE_INLINE;
+		}else{
+			cont=(tracecont*)trace_slot(trace->head,pos+i);
+			cont->kind=TR_CONTINUE;
+			dst=cont->path;
+			room=TRACE_CONT;
+		}for(k=0;k<room && done<len;k++,done++)
+			dst[k]=(done<len1)?path[done]:(done==len1)?'\0':path2[done-len1-1];
+		if(k<room) memset(dst+k,0,room-k);
+	}__atomic_store_n(&trace->head->head,pos+n+1,__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&trace->lock);
+}
+
+void trace_close(tracebuf *trace)
+{
+	if(trace==NULL) return;
+	msync(trace->head,trace->maplen,MS_SYNC);
+	munmap(trace->head,trace->maplen);
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+}
+
+size_t trace_map(const char *file, tracehead **head)
+{
+	struct stat st;
+	tracehead *map;
+	int fd;
+
+	if((fd=open(file,O_RDONLY))<0) return 0;
+	if(fstat(fd,&st)<0 || (size_t)st.st_size<sizeof(tracehead) ||
+		(map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0))==MAP_FAILED){
+		close(fd);
+		return 0;
+	}close(fd);
+	if(map->magic!=TRACE_MAGIC || map->slots<2 ||
+		map->slots>((size_t)st.st_size-sizeof(tracehead))/TRACE_SLOT){
+		munmap(map,st.st_size);
+		errno=EINVAL;
+		return 0;
+	}*head=map;
+	return st.st_size;
+}
+
+int trace_next(tracehead *head, uint64_t *pos, tracerec *rec, char *buf)
+{
+	traceslot *slot;
+	tracecont *cont;
+	size_t n, i, len, done;
+
+	for(;*pos<head->head;(*pos)++){
+		slot=trace_slot(head,*pos);
+		if(slot->kind!=TR_START || slot->len>TRACE_MAXPATH) continue;
+		len=slot->len;
+		n=CONT_SLOTS(len);
+		if(*pos+n>=head->head) return 0;
+		memcpy(buf,slot->path,(len<TRACE_INLINE)?len:TRACE_INLINE);
+		for(i=1,done=TRACE_INLINE;i<=n;i++,done+=TRACE_CONT){
+			cont=(tracecont*)trace_slot(head,*pos+i);
+			if(cont->kind!=TR_CONTINUE) break;
+			memcpy(buf+done,cont->path,(len-done<TRACE_CONT)?len-done:TRACE_CONT);
+		}if(i<=n) continue;
+		buf[len]='\0';
+		rec->op=slot->op&((1<<TRACE_OPBITS)-1);
+		rec->mode=slot->op>>TRACE_OPBITS;
+		rec->res=slot->res;
+		rec->start=slot->start;
+		rec->dur=slot->dur;
+		rec->size=slot->size;
+		rec->offset=slot->offset;
+		rec->path=buf;
+		rec->path2=(strlen(buf)<len)?buf+strlen(buf)+1:NULL;
+		*pos+=n+1;
+		return 1;
+	}return 0;
+}
@@ -0,0 +1,123 @@
+/*CSCE321 HW4: myfs
+	myfs_trace.h: binary ring buffer trace of FUSE operations, written by myfs.c and read by replay.c
+*/
+
+/*Trace Constants
+	TRACE_MAGIC		identifies a trace file and its format version
+	TRACE_SLOT		size of one slot of the ring, every record takes one or more slots
+	TRACE_INLINE	path bytes stored in a start slot
+	TRACE_CONT		path bytes stored in a continuation slot
+	TR_START		slot kind of the first slot of a record
+	TR_CONTINUE		slot kind of the slots holding the rest of a record's path
+	TRACE_MAXPATH	longest path data a record can hold
+	TRACE_OPBITS	low bits of a slot's op holding the operation id, the bits above hold the fallocate mode
+*/
+/*Trace Types
+	tracehead		first slot of the trace file
+		magic			TRACE_MAGIC
+		slots			number of slots in the ring, following the header
+		head			number of slots ever written, the next slot is head%slots, the ring has wrapped if head>slots
+		epoch			CLOCK_REALTIME in ns when the trace was started
+	traceslot		start slot of a record
+		kind			TR_START
+		op				operation id, one of the ST_* callback ids of myfs_stats.h, for fallocate or'ed with its
+						mode shifted by TRACE_OPBITS
+		len				bytes of path data, for rename both paths separated by a NUL
+		res				result of the operation, 0 or positive on success, -errno on failure
+		start			start time in ns since epoch
+		dur				duration in ns, saturated at UINT32_MAX
+		size			size argument of read and write, length of fallocate
+		offset			offset of read, write and fallocate, new size of truncate
+		path			first TRACE_INLINE bytes of the path data
+	tracecont		continuation slot
+		kind			TR_CONTINUE
+		path			next TRACE_CONT bytes of the path data
+	tracebuf		open trace being written, only in process memory
+	tracerec		one record as returned by trace_next, path points into the reader's buffer
+*/
+/*Trace Functions
+	trace_open(*file, slots)
+		creates or truncates file and maps a ring of slots slots, returns NULL on failure with errno set
+	trace_log(*trace, op, *path, *path2, offset, size, start, res)
+		appends one record, start is a stat_now() time, path2 is the second path of rename or NULL
+	trace_close(*trace)
+		flushes and unmaps the trace
+	trace_map(*file, **head)
+		maps file read-only and checks its header, returns its size or 0 on failure
+	trace_next(*head, *pos, *rec, *buf)
+		reads the record at or after *pos into rec, assembling its path in buf of TRACE_MAXPATH+1 bytes,
+		advances *pos past it, returns 0 at the end of the trace
+		*pos starts at trace_first(head), records partly overwritten by the ring wrapping are skipped
+*/
+
+#ifndef MYFS_TRACE_H
+#define MYFS_TRACE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC		0x3143525453594d46ULL
+#define TRACE_SLOT		64
+#define TRACE_INLINE	32
+#define TRACE_CONT		(TRACE_SLOT-1)
+#define TR_START		1
+#define TR_CONTINUE		2
+#define TRACE_MAXPATH	8192
+#define TRACE_OPBITS	6
+
+typedef struct{
+	uint64_t magic;
+	uint64_t slots;
+	uint64_t head;
+	uint64_t epoch;
+	char pad[TRACE_SLOT-4*sizeof(uint64_t)];
+} tracehead;
+
+typedef struct{
+	uint8_t kind;
+	uint8_t op;
+	uint16_t len;
+	int32_t res;
+	uint64_t start;
+	uint32_t dur;
+	uint32_t size;
+	int64_t offset;
+	char path[TRACE_INLINE];
+} traceslot;
+
+typedef struct{
+	uint8_t kind;
+	char path[TRACE_CONT];
+} tracecont;
+
+typedef struct{
+	pthread_mutex_t lock;
+	tracehead *head;
+	size_t maplen;
+	uint64_t epoch;
+} tracebuf;
+
+typedef struct{
+	int op;
+	int mode;
+	int res;
+	uint64_t start;
+	uint32_t dur;
+	size_t size;
+	int64_t offset;
+	const char *path;
+	const char *path2;
+} tracerec;
+
+#define trace_slot(head,pos)	((traceslot*)((char*)((head)+1)+((pos)%(head)->slots)*TRACE_SLOT))
+#define trace_first(head)		(((head)->head>(head)->slots)?(head)->head-(head)->slots:0)
+
+tracebuf *trace_open(const char *file, size_t slots);
+void trace_log(tracebuf *trace, int op, const char *path, const char *path2, int64_t offset, size_t size,
+	uint64_t start, int res);
+void trace_close(tracebuf *trace);
+size_t trace_map(const char *file, tracehead **head);
+int trace_next(tracehead *head, uint64_t *pos, tracerec *rec, char *buf);
+
+#endif
@@ -0,0 +1,241 @@
+/*CSCE321 HW4: myfs
+	replay.c: replays a trace recorded with myfs --trace against a copy of an image, without FUSE
+*/
+
+/*Replay Details
+	The image is mapped copy-on-write, so the image file itself is never changed, -o saves the result
+	For the replay to be deterministic the image must be the state the filesystem was in when the trace started,
+		so copy the backup file before mounting with --trace, and size the trace so it does not wrap
+	Every record is fed to the matching __myfs_*_implem function, in trace order, as fast as possible
+		or with -p at the pace the operations originally arrived at
+	Data is not traced, writes write a fixed pattern of the recorded size at the recorded offset,
+		utimens sets the current time, fallocate lengths past 4GB are saturated like read and write sizes
+	fsync and release release the blocks reserved past the end of the file, as myfs does,
+		fsync of a directory is only counted
+	A result different from the traced one is a divergence, usually because the image was not the starting state,
+		divergences are counted and with -v printed
+	Timings are recorded with myfs_stats.c, so the report has the same format as /.myfs/stats
+		and breaks the operations down into the helpers they spend their time in
+	-d prints the trace as text instead of replaying it
+*/
+
+#include <sys/mman.h>
+#include <inttypes.h>
+
+#include "myfs_helper.h"
+#include "myfs_stats.h"
+#include "myfs_trace.h"
+
+/* Declaration for the implementations of the operations */
+
+int __myfs_getattr_implem(void *, size_t, int *, uid_t, gid_t, const char *, struct stat *);
+int __myfs_readdir_implem(void *, size_t, int *, const char *, char ***);
+int __myfs_mknod_implem(void *, size_t, int *, const char *);
+int __myfs_unlink_implem(void *, size_t, int *, const char *);
+int __myfs_mkdir_implem(void *, size_t, int *, const char *);
+int __myfs_rmdir_implem(void *, size_t, int *, const char *);
+int __myfs_rename_implem(void *, size_t, int *, const char *, const char*);
+int __myfs_truncate_implem(void *, size_t, int *, const char *, off_t);
+int __myfs_open_implem(void *, size_t, int *, const char *);
+int __myfs_read_implem(void *, size_t, int *, const char *, char *, size_t, off_t);
+int __myfs_write_implem(void *, size_t, int *, const char *, const char *, size_t, off_t);
+int __myfs_statfs_implem(void *, size_t, int *, struct statvfs*);
+int __myfs_utimens_implem(void *, size_t, int *, const char *, const struct timespec [2]);
+int __myfs_release_implem(void *, size_t, int *, const char *);
+int __myfs_fallocate_implem(void *, size_t, int *, const char *, int, off_t, off_t);
+
+/* End of declarations */
+
+static const char *opnames[ST_LOOKUP]={
+	"getattr", "readdir", "mknod", "unlink", "mkdir", "rmdir", "rename", "truncate",
+	"open", "read", "write", "statfs", "utimens", "fsync", "release", "fallocate"
+};
+
+typedef struct{
+	void *fsptr;
+	size_t fssize;
+	char *buf;
+	size_t buflen;
+	size_t ops;
+	size_t diverged;
+	size_t skipped;
+} replayctx;
+
+static int replayone(replayctx *ctx, tracerec *rec)
+{
+	struct timespec ts[2]={{0,UTIME_NOW},{0,UTIME_NOW}};
+	struct statvfs stv;
+	struct stat st;
+	char **names=NULL;
+	int err=0, res=0;
+
+	if(rec->size>ctx->buflen){
+		char *buf=realloc(ctx->buf,rec->size);
+		if(buf==NULL) return -ENOMEM;
+		memset(buf+ctx->buflen,0x5a,rec->size-ctx->buflen);
+		ctx->buf=buf;
+		ctx->buflen=rec->size;
+	}switch(rec->op){
+		case ST_GETATTR:
+			res=__myfs_getattr_implem(ctx->fsptr,ctx->fssize,&err,getuid(),getgid(),rec->path,&st);
+			break;
+		case ST_READDIR:
+			res=__myfs_readdir_implem(ctx->fsptr,ctx->fssize,&err,rec->path,&names);
+			if(res>0 && names!=NULL){
+				int i;
+				for(i=0;i<res;i++) free(names[i]);
+				free(names);
+			}break;
+		case ST_MKNOD: res=__myfs_mknod_implem(ctx->fsptr,ctx->fssize,&err,rec->path); break;
+		case ST_UNLINK: res=__myfs_unlink_implem(ctx->fsptr,ctx->fssize,&err,rec->path); break;
+		case ST_MKDIR: res=__myfs_mkdir_implem(ctx->fsptr,ctx->fssize,&err,rec->path); break;
+		case ST_RMDIR: res=__myfs_rmdir_implem(ctx->fsptr,ctx->fssize,&err,rec->path); break;
+		case ST_RENAME:
+			if(rec->path2==NULL) return -EINVAL;
+			res=__myfs_rename_implem(ctx->fsptr,ctx->fssize,&err,rec->path,rec->path2);
+			break;
+		case ST_TRUNCATE: res=__myfs_truncate_implem(ctx->fsptr,ctx->fssize,&err,rec->path,rec->offset); break;
+		case ST_OPEN: res=__myfs_open_implem(ctx->fsptr,ctx->fssize,&err,rec->path); break;
+		case ST_READ:
+			res=__myfs_read_implem(ctx->fsptr,ctx->fssize,&err,rec->path,ctx->buf,rec->size,rec->offset);
+			break;
+		case ST_WRITE:
+			res=__myfs_write_implem(ctx->fsptr,ctx->fssize,&err,rec->path,ctx->buf,rec->size,rec->offset);
+			break;
+		case ST_STATFS: res=__myfs_statfs_implem(ctx->fsptr,ctx->fssize,&err,&stv); break;
+		case ST_UTIMENS: res=__myfs_utimens_implem(ctx->fsptr,ctx->fssize,&err,rec->path,ts); break;
+		case ST_FSYNC:
+		case ST_RELEASE:
+			res=__myfs_release_implem(ctx->fsptr,ctx->fssize,&err,rec->path);
+			if(rec->op==ST_FSYNC && res<0) res=0;
+			break;
+		case ST_FALLOCATE:
+			res=__myfs_fallocate_implem(ctx->fsptr,ctx->fssize,&err,rec->path,rec->mode,rec->offset,rec->size);
+			break;
+		default: return -EINVAL;
+	}return (res>=0)?res:-err;
+}
+
+static void printrec(FILE *out, const tracerec *rec)
+{
+	fprintf(out,"%12.6f %-8s %s%s%s",rec->start/1e9,opnames[rec->op],rec->path,
+		(rec->path2!=NULL)?" -> ":"",(rec->path2!=NULL)?rec->path2:"");
+	if(rec->op==ST_READ || rec->op==ST_WRITE) fprintf(out," off %" PRId64 " size %lu",rec->offset,rec->size);
+	if(rec->op==ST_FALLOCATE) fprintf(out," mode %d off %" PRId64 " len %lu",rec->mode,rec->offset,rec->size);
+	if(rec->op==ST_TRUNCATE) fprintf(out," size %" PRId64,rec->offset);
+	fprintf(out," = %d (%.1fus)",rec->res,rec->dur/1e3);
+}
+
+static int mapimage(replayctx *ctx, const char *file)
+{
+	struct stat st;
+	int fd;
+
+	if((fd=open(file,O_RDONLY))<0) return -1;
+	if(fstat(fd,&st)<0 || st.st_size==0){
+		close(fd);
+		errno=EINVAL;
+		return -1;
+	}ctx->fssize=st.st_size;
+	ctx->fsptr=mmap(NULL,ctx->fssize,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+	close(fd);
+	return (ctx->fsptr==MAP_FAILED)?-1:0;
+}
+
+static int saveimage(replayctx *ctx, const char *file)
+{
+	size_t done=0;
+	ssize_t res=0;
+	int fd;
+
+	if((fd=open(file,O_CREAT|O_WRONLY|O_TRUNC,00644))<0) return -1;
+	while(done<ctx->fssize && (res=write(fd,(char*)ctx->fsptr+done,ctx->fssize-done))>0) done+=res;
+	if(close(fd)<0 || res<0) return -1;
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,"usage: %s [-p] [-v] [-o outimage] trace image\n"
+		"       %s -d trace\n",name,name);
+}
+
+int main(int argc, char *argv[])
+{
+	replayctx ctx;
+	tracehead *head;
+	tracerec rec;
+	uint64_t pos, t0, start;
+	size_t maplen;
+	char *path;
+	const char *out=NULL;
+	int opt, pace=0, verbose=0, dump=0;
+
+	memset(&ctx,0,sizeof(ctx));
+	while((opt=getopt(argc,argv,"pvdo:h"))!=-1){
+		switch(opt){
+			case 'p': pace=1; break;
+			case 'v': verbose=1; break;
+			case 'd': dump=1; break;
+			case 'o': out=optarg; break;
+			default: usage(argv[0]); return 1;
+		}
+	}if(optind+(dump?1:2)!=argc){
+		usage(argv[0]);
+		return 1;
+	}if((maplen=trace_map(argv[optind],&head))==0){
+		perror(argv[optind]);
+		return 2;
+	}if((path=malloc(TRACE_MAXPATH+1))==NULL) return 2;
+	if(head->head>head->slots){
+		fprintf(stderr,"warning: the trace wrapped, the oldest operations are lost and the replay will diverge\n");
+	}
+
+	if(dump){
+		for(pos=trace_first(head);trace_next(head,&pos,&rec,path);){
+			if(rec.op>=ST_LOOKUP) continue;
+			printrec(stdout,&rec);
+			fputc('\n',stdout);
+		}free(path);
+		munmap(head,maplen);
+		return 0;
+	}
+
+	if(mapimage(&ctx,argv[optind+1])!=0){
+		perror(argv[optind+1]);
+		return 2;
+	}t0=stat_now();
+	for(pos=trace_first(head);trace_next(head,&pos,&rec,path);){
+		int res;
+		if(rec.op>=ST_LOOKUP){
+			ctx.skipped++;
+			continue;
+		}if(pace){
+			uint64_t now=stat_now()-t0;
+			if(rec.start>now){
+				struct timespec ts={(rec.start-now)/1000000000,(rec.start-now)%1000000000};
+				nanosleep(&ts,NULL);
+			}
+		}start=stat_now();
+		res=replayone(&ctx,&rec);
+		stat_end(rec.op,start,res<0);
+		ctx.ops++;
+		if(res!=rec.res){
+			ctx.diverged++;
+			if(verbose){
+				printrec(stderr,&rec);
+				fprintf(stderr,", replayed %d\n",res);
+			}
+		}
+	}t0=stat_now()-t0;
+	printf("replayed %lu operations in %.3fs, %lu diverged, %lu unknown skipped\n",ctx.ops,t0/1e9,
+		ctx.diverged,ctx.skipped);
+	fflush(stdout);
+	stat_dump(STDOUT_FILENO);
+	if(out!=NULL && saveimage(&ctx,out)!=0) perror(out);
+	free(path);
+	free(ctx.buf);
+	munmap(ctx.fsptr,ctx.fssize);
+	munmap(head,maplen);
+	return 0;
+}